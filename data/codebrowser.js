@@ -829,6 +829,16 @@ $(function () {
         }
 
         var tt = this;
+        // The big macro expansions are not in the page
+        var expansion = isMacro && !this.title_ && elem.attr("data-expansion");
+        if (expansion && !this.expansion_loaded) {
+            this.expansion_loaded = true;
+            $.get(root_path + "/macros/" + expansion, function(data) {
+                tt.title_ = identAndHighlightMacro(data);
+                if (tooltip.ref === ref)
+                    computeTooltipContent(tt.tooltip_data, tt.title_, tt.id);
+            }, "text");
+        }
         if (ref && !this.tooltip_loaded && !elem.hasClass("local") && !elem.hasClass("tu")
                 && !elem.hasClass("typedef") && !elem.hasClass("lbl")) {
             this.tooltip_loaded = true;
@@ -1004,7 +1014,7 @@ $(function () {
         if (searchTerms)
             return;
         searchTerms = {}
-        var fileIndex = [];
+        var fileDict = {}; // fileSearch key -> list of files
         var functionDict = {};
 
         // Do a google seatch of the text on the project.
@@ -1068,6 +1078,20 @@ $(function () {
             return k.replace(/[^a-z]/, '_')
         }
 
+        // ATTENTION: Keep in sync with writeFileSearch in indexer.cpp
+        // The key is the start of the last component of the path that has at least three
+        // characters: the shard of that key lists all the paths it can match.
+        var getFileSearchKey = function (request) {
+            if (request.indexOf('::') != -1)
+                return false; // a function name
+            var parts = request.split('/');
+            for (var i = parts.length - 1; i >= 0; --i) {
+                if (parts[i].length >= 3)
+                    return parts[i].substr(0, 3).toLowerCase().replace(/[^a-z]/g, '_');
+            }
+            return false;
+        }
+
         var autocomplete = function(request, response) {
             var term = $.ui.autocomplete.escapeRegex(request.term);
             var rx1 = new RegExp(term, 'i');
@@ -1078,7 +1102,9 @@ $(function () {
                 functionList = functionDict[k].filter(
                     function(word) { return word.match(rx2) });
             }
-            var l = fileIndex.filter( function(word) { return word.match(rx1); });
+            var fk = getFileSearchKey(request.term);
+            var files = (fk && fileDict[fk]) || [];
+            var l = files.filter( function(word) { return word.match(rx1); });
             l = l.concat(functionList);
             l = l.slice(0,1000); // too big lists are too slow
             response(l);
@@ -1096,6 +1122,22 @@ $(function () {
         // When the content changes, fetch the list of function that starts with ...
         searchline.on('input', function() {
             var value = $(this).val();
+            var fk = getFileSearchKey(value);
+            if (fk && !Object.prototype.hasOwnProperty.call(fileDict, fk)) {
+                fileDict[fk] = null; // loading
+                $.get(root_path + '/fileSearch/' + fk, function(data) {
+                    var list = data.split("\n").filter(function(f) { return f.length > 0; });
+                    for (var i = 0; i < list.length; ++i) {
+                        searchTerms[list[i]] = { type:"file", file: list[i] };
+                    }
+                    fileDict[fk] = list;
+                    if (searchline.is(":focus")) {
+                        searchline.autocomplete("search", searchline.val());
+                    }
+                }).fail(function() {
+                    fileDict[fk] = []; // no path contains the key
+                });
+            }
             var k = getFnNameKey(value);
             if (k && !Object.prototype.hasOwnProperty.call(functionDict, k)) {
                 functionDict[k] = []
@@ -1122,18 +1164,6 @@ $(function () {
         });
 //END
 
-        // Fetch the list of all files
-        $.get(root_path + '/fileIndex', function(data) {
-            var list = data.split("\n");
-            fileIndex = list;
-            for (var i = 0; i < list.length; ++i) {
-                searchTerms[list[i]] = { type:"file", file: list[i] };
-            }
-            if (searchline.is(":focus")) {
-                searchline.autocomplete("search", searchline.val());
-            }
-        });
-
         return false;
     });
 
@@ -1202,6 +1232,11 @@ $(function () {
     var cwo_url = 'https://code.woboq.org';
     $("#header").prepend("<a class='logo' href='" + cwo_url + "'><img src='" + cwo_url + "/data/woboq-48.png'/></a>");
 
+    // Pages shared through a content store don't contain the date and revision they were generated at
+    $("#generation_info").each(function() {
+        $(this).load(root_path + "/" + $(this).attr("data-project") + "/generation_info.html");
+    });
+
 /*-------------------------------------------------------------------------------------*/
 
 
@@ -1368,9 +1403,6 @@ $(function () {
     }
 
 
-    // Pre-fetch index. The XMLHttpRequest above will take it from browser cache then
-    $("head").append('<link rel="prefetch" href="'+root_path + '/fileIndex'+'">');
-
 /*-------------------------------------------------------------------------------------*/
     // End: print the time that was required to execute the code browser javascript
     elapsed = new Date().getTime() - start;
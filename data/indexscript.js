@@ -53,7 +53,7 @@ $(function() {
         window.location = "http://google.com/search?sitesearch=" + encodeURIComponent(location) + "&q=" + encodeURIComponent(text);
     }
 
-    var fileIndex = [];
+    var fileDict = {}; // fileSearch key -> list of files
     var searchTerms = {}
     var functionDict = {};
     var file = path;
@@ -111,6 +111,20 @@ $(function() {
             return k.replace(/[^a-z]/, '_')
         }
 
+        // ATTENTION: Keep in sync with writeFileSearch in indexer.cpp
+        // The key is the start of the last component of the path that has at least three
+        // characters: the shard of that key lists all the paths it can match.
+        var getFileSearchKey = function (request) {
+            if (request.indexOf('::') != -1)
+                return false; // a function name
+            var parts = request.split('/');
+            for (var i = parts.length - 1; i >= 0; --i) {
+                if (parts[i].length >= 3)
+                    return parts[i].substr(0, 3).toLowerCase().replace(/[^a-z]/g, '_');
+            }
+            return false;
+        }
+
         var autocomplete = function(request, response) {
             var term = $.ui.autocomplete.escapeRegex(request.term);
             var rx1 = new RegExp(term, 'i');
@@ -121,7 +135,9 @@ $(function() {
                 functionList = functionDict[k].filter(
                     function(word) { return word.match(rx2) });
             }
-            var l = fileIndex.filter( function(word) { return word.match(rx1); });
+            var fk = getFileSearchKey(request.term);
+            var files = (fk && fileDict[fk]) || [];
+            var l = files.filter( function(word) { return word.match(rx1); });
             l = l.concat(functionList);
             l = l.slice(0,1000); // too big lists are too slow
             response(l);
@@ -139,6 +155,22 @@ $(function() {
         // When the content changes, fetch the list of function that starts with ...
         searchline.on('input', function() {
             var value = $(this).val();
+            var fk = getFileSearchKey(value);
+            if (fk && !Object.prototype.hasOwnProperty.call(fileDict, fk)) {
+                fileDict[fk] = null; // loading
+                $.get(root_path + '/fileSearch/' + fk, function(data) {
+                    var list = data.split("\n").filter(function(f) { return f.length > 0; });
+                    for (var i = 0; i < list.length; ++i) {
+                        searchTerms[list[i]] = { type:"file", file: list[i] };
+                    }
+                    fileDict[fk] = list;
+                    if (searchline.is(":focus")) {
+                        searchline.autocomplete("search", searchline.val());
+                    }
+                }).fail(function() {
+                    fileDict[fk] = []; // no path contains the key
+                });
+            }
             var k = getFnNameKey(value);
             if (k && !Object.prototype.hasOwnProperty.call(functionDict, k)) {
                 functionDict[k] = []
@@ -167,80 +199,104 @@ $(function() {
     //END  copied from codebrowser.js
 
 
-    $.get(root_path + '/fileIndex', function(data) {
-        var list = data.split("\n");
-        list.sort();
-
-        fileIndex = list;
-        for (var i = 0; i < list.length; ++i) {
-            searchTerms[list[i]] = { type:"file", file: list[i] };
-        }
+    // ATTENTION: Keep in sync with linkInterestingDefinitions in indexer.cpp
+    var linkDefinitions = function(file, defs) {
+        if (!defs)
+            return "";
+        var result = "<ul>";
+        defs.split(",").forEach(function(def) {
+            if (!def)
+                return;
+            var name = def;
+            if (def.indexOf("(anonymous") == -1)
+                name = def.replace(/.*:/, "");
+            result += "<li><a href='" + file + "#" + def + "' title='" + def + "'>" + name + "</a></li>";
+        });
+        return result + "</ul>";
+    }
 
+    // Returns the rows of the table for the entries of a index.json listing
+    var listingRows = function(entries, p, subPath, toOpen) {
+        var rows = "";
+        entries.forEach(function(entry) {
+            var name = entry.name;
+            if (entry.folder) {
+                rows += "<tr><td class='folder'><a class='opener' data-path='" + p + name + "'  href='"+subPath + name+"/'>[+]</a> " +
+                        "<a href='" + subPath + name + "/'>" + name + "/</a></td><td></td></tr>\n";
+                if (toOpen)
+                    toOpen(p + name);
+            } else {
+                rows += "<tr><td class='file'>    <a href='" + subPath + name + ".html'>" + name + "</a>" +
+                        "<span class='meta'>" + linkDefinitions(subPath + name + ".html", entry.defs) + "</span></td></tr>\n";
+            }
+        });
+        return rows;
+    }
 
-        function openFolder() {
-            var t = $(this);
-            var state = {};
-            if (history)
-                state = history.state || state;
-            if (!this._opened) {
-                this._opened = true;
-                var p = t.attr("data-path") + "/";
-                var subPath = path=="" ? p : p.substr(path.length);
-                t.text("[-]");
-                var content = $("<table/>");
-                var dict = {};
+    function openFolder() {
+        var t = $(this);
+        var opener = this;
+        var state = {};
+        if (history)
+            state = history.state || state;
+        if (!this._opened) {
+            this._opened = true;
+            var p = t.attr("data-path") + "/";
+            var subPath = path=="" ? p : p.substr(path.length);
+            t.text("[-]");
+            var content = $("<table/>");
+            t.parent().append(content);
+            $.getJSON(root_path + '/' + p + 'index.json', function(entries) {
+                if (!opener._opened)
+                    return;
                 var toOpenNow = [];
-                for (var i=0; i < fileIndex.length; ++i) {
-                    var f = fileIndex[i];
-                    if (f.indexOf(p) == 0) {
-                        var sl = f.indexOf('/',  p.length + 1);
-
-                        if (sl !== -1) {
-                            var name = f.substr( p.length, sl - p.length);
-                            if (dict[name])
-                                continue;
-                            dict[name] = true;
-                            content.append("<tr><td class='folder'><a class='opener' data-path='" + p + name + "'  href='"+subPath + name+"'>[+]</a> " +
-                                        "<a href='" + subPath + name + "/'>" + name + "/</a></td></tr>\n");
-                            if (state[p+name])
-                                toOpenNow.push(p+name);
-                        } else {
-                            var name = f.substr(p.length);
-                            content.append("<tr><td class='file'>    <a href='" + subPath + name + ".html'>" + name + "</a></td></tr>\n");
-                        }
-                    }
-                }
+                content.append(listingRows(entries, p, subPath, function(folder) {
+                    if (state[folder])
+                        toOpenNow.push(folder);
+                }));
                 content.find(".opener").click(openFolder);
-                t.parent().append(content);
-                state[t.attr("data-path")]=true;
-                toOpenNow.forEach(function(toOpen) { 
+                toOpenNow.forEach(function(toOpen) {
                     var e = $("a[data-path='"+toOpen+"']").get(0)
-                    if (e) 
+                    if (e)
                         openFolder.call(e);
                 });
-            } else {
-                t.parent().find("> table").empty();
-                t.text("[+]");
-                this._opened = false;
-                state[t.attr("data-path")]=false;
-            }
-            if (history && history.replaceState)
-                history.replaceState(state, undefined);
-            return false;
-        }
-
-        $(".opener").click(openFolder);
-        var state;
-        if (history)
-            state = history.state;
-        if (state) {
-            $(".opener").each(function(e) {
-                if (state[$(this).attr("data-path")])
-                    openFolder.call(this);
             });
+            state[t.attr("data-path")]=true;
+        } else {
+            t.parent().find("> table").remove();
+            t.text("[+]");
+            this._opened = false;
+            state[t.attr("data-path")]=false;
         }
+        if (history && history.replaceState)
+            history.replaceState(state, undefined);
+        return false;
+    }
+
+    // Big folders only have their first entries in the page, the others are in index.json
+    $("a.more").click(function() {
+        var t = $(this);
+        var offset = parseInt(t.attr("data-offset"));
+        $.getJSON(t.attr("href"), function(entries) {
+            var row = t.closest("tr");
+            row.after(listingRows(entries.slice(offset), path, ""));
+            row.nextAll().find(".opener").click(openFolder);
+            row.remove();
+        });
+        return false;
     });
 
+    $(".opener").click(openFolder);
+    var state;
+    if (history)
+        state = history.state;
+    if (state) {
+        $(".opener").each(function(e) {
+            if (state[$(this).attr("data-path")])
+                openFolder.call(this);
+        });
+    }
+
     $("#footer").before("<div id='whatisit'><h3>What is this ?</h3><p>This is an online code browser that allows you to browse C/C++ code just like in your IDE, "
                         +  "with <b>semantic highlighting</b> and contextual <b>tooltips</b> that show you the usages and cross references.<br/>"
 						+  "Open a C or C++ file and try it by hovering over the symbols!<br />"
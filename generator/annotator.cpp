@@ -33,6 +33,7 @@
 #include <clang/AST/PrettyPrinter.h>
 #include <clang/AST/ASTContext.h>
 #include <clang/AST/RecordLayout.h>
+#include <clang/Lex/HeaderSearch.h>
 #include <clang/Lex/Lexer.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Sema/Sema.h>
@@ -44,7 +45,9 @@
 #include <time.h>
 
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
 
@@ -190,6 +193,15 @@ bool Annotator::shouldProcess(clang::FileID FID)
 }
 
 
+bool Annotator::hasInclusionBetween(clang::FileID FID, unsigned begin, unsigned end)
+{
+    auto it = inclusionOffsets.find(FID);
+    if (it == inclusionOffsets.end())
+        return false;
+    auto inclusion = std::lower_bound(it->second.begin(), it->second.end(), begin);
+    return inclusion != it->second.end() && *inclusion <= end;
+}
+
 std::string Annotator::htmlNameForFile(clang::FileID id)
 {
     {
@@ -237,16 +249,12 @@ void Annotator::registerInterestingDefinition(clang::SourceRange sourceRange, cl
 
 bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
 {
-    std::ofstream fileIndex;
-    fileIndex.open(projectManager.outputPrefix + "/fileIndex", std::ios::app);
-    if (!fileIndex) {
-        create_directories(projectManager.outputPrefix);
-        fileIndex.open(projectManager.outputPrefix + "/fileIndex", std::ios::app);
-        if (!fileIndex) {
-            std::cerr << "Can't generate index for " << std::endl;
-            return false;
-        }
-    }
+    llvm::raw_ostream &fileIndex = projectManager.appendStream(projectManager.outputPrefix + "/fileIndex");
+    outputs.push_back(projectManager.outputPrefix + "/fileIndex");
+
+    // The interesting definitions are also in the <meta> of the pages, but the index generator
+    // reads them from this file so it does not have to parse all the pages.
+    llvm::raw_ostream *definitionIndex = nullptr;
 
     // make sure the main file is in the cache.
     htmlNameForFile(getSourceMgr().getMainFileID());
@@ -277,7 +285,8 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
 
         std::string footer;
         clang::FileID mainFID = getSourceMgr().getMainFileID();
-        if (FID != mainFID) {
+        // (The generated file including a batch of headers has no page)
+        if (FID != mainFID && !htmlNameForFile(mainFID).empty()) {
             footer  = "Generated while processing <a href='" %  pathTo(FID, mainFID) % "'>" % htmlNameForFile(mainFID) % "</a><br/>";
         }
 
@@ -287,10 +296,10 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
         strftime(buf, sizeof(buf), "%Y-%b-%d", tm);
 
         const ProjectInfo &projectinfo = *project_it;
-        footer %= "Generated on <em>" % std::string(buf) % "</em>"
+        std::string generationInfo = "Generated on <em>" % std::string(buf) % "</em>"
             % " from project " % projectinfo.name;
         if (!projectinfo.revision.empty())
-            footer %= " revision <em>" % projectinfo.revision % "</em>";
+            generationInfo %= " revision <em>" % projectinfo.revision % "</em>";
 
         /*     << " from file <a href='" << projectinfo.fileRepoUrl(filename) << "'>" << filename << "</a>"
         title=\"Arguments: << " << Generator::escapeAttr(args)   <<"\"" */
@@ -299,7 +308,7 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
 #if CLANG_VERSION_MAJOR >= 12
         const llvm::StringRef Buf = getSourceMgr().getBufferData(FID);
         g.generate(projectManager.outputPrefix, projectManager.dataPath, fn,
-                   Buf.begin(), Buf.end(), footer,
+                   Buf.begin(), Buf.end(), footer, projectinfo.name, generationInfo,
                    WasInDatabase ? "" : "Warning: That file was not part of the compilation database. "
                                         "It may have many parsing errors.",
                    interestingDefinitionsInFile[FID]);
@@ -308,20 +317,59 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
         const llvm::MemoryBuffer *Buf = getSourceMgr().getBuffer(FID);
         g.generate(projectManager.outputPrefix, projectManager.dataPath, fn,
                    Buf->getBufferStart(), Buf->getBufferEnd(), footer,
+                   projectinfo.name, generationInfo,
                    WasInDatabase ? "" : "Warning: That file was not part of the compilation database. "
                                         "It may have many parsing errors.",
                    interestingDefinitionsInFile[FID]);
 
 #endif
+        projectManager.markGenerated(fn);
+        outputs.push_back(projectManager.outputPrefix % "/" % fn % ".html");
+        if (!Generator::contentStore.empty())
+            outputs.push_back(projectManager.outputPrefix % "/" % projectinfo.name % "/generation_info.html");
 
-        if (projectinfo.type == ProjectInfo::Normal)
+        if (projectinfo.type == ProjectInfo::Normal) {
             fileIndex << fn << '\n';
+            const auto &definitions = interestingDefinitionsInFile[FID];
+            if (!definitions.empty()) {
+                if (!definitionIndex) {
+                    definitionIndex = &projectManager.appendStream(projectManager.outputPrefix + "/interestingDefinitions");
+                    outputs.push_back(projectManager.outputPrefix + "/interestingDefinitions");
+                }
+                *definitionIndex << fn << '|' << llvm::join(definitions.begin(), definitions.end(), ",") << '\n';
+            }
+        }
     }
 
     // make sure all the docs are in the references
     // (There might not be when the comment is in the .cpp file (for \class))
     for (auto it : commentHandler.docs) references[it.first];
 
+    clang::SourceManager &sm = getSourceMgr();
+
+    // The escaped name of the html file of a FileID, or an empty string if it is not generated.
+    std::map<clang::FileID, std::string> escapedFileNames;
+    auto escapedNameForFile = [&](clang::FileID FID) -> const std::string & {
+        auto nameIt = escapedFileNames.find(FID);
+        if (nameIt == escapedFileNames.end()) {
+            std::string fn = htmlNameForFile(FID);
+            llvm::SmallString<64> buffer;
+            nameIt = escapedFileNames.insert({FID, Generator::escapeAttr(fn, buffer).str()}).first;
+        }
+        return nameIt->second;
+    };
+
+    // The uses of a declaration are written sorted by file and offset, so the name of a file is
+    // looked up once per run of uses, and the line lookups of the SourceManager, which resume
+    // from the previous query in the same file, only move forward.
+    struct ExpandedReference {
+        clang::FileID FID;
+        unsigned offset;
+        clang::SourceLocation expBegin, expEnd;
+        const Reference *ref;
+    };
+    std::vector<ExpandedReference> expandedRefs;
+
     create_directories(llvm::Twine(projectManager.outputPrefix, "/refs/_M"));
     for (const auto &it : references) {
         if (llvm::StringRef(it.first).startswith("__builtin"))
@@ -333,35 +381,37 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
         replace_invalid_filename_chars(refFilename);
 
         std::string filename = projectManager.outputPrefix % "/refs/" % refFilename;
-#if CLANG_VERSION_MAJOR==3 && CLANG_VERSION_MINOR<=5
-        std::string error;
-        llvm::raw_fd_ostream myfile(filename.c_str(), error, llvm::sys::fs::F_Append);
-        if (!error.empty()) {
-            std::cerr << error<< std::endl;
-            continue;
-        }
-#else
-        std::error_code error_code;
-#if CLANG_VERSION_MAJOR >= 13
-        llvm::raw_fd_ostream myfile(filename, error_code, llvm::sys::fs::OF_Append);
-#else
-        llvm::raw_fd_ostream myfile(filename, error_code, llvm::sys::fs::F_Append);
-#endif
-        if (error_code) {
-            std::cerr << "Error writing ref file " << filename << ": " << error_code.message() << std::endl;
-            continue;
-        }
-#endif
+        if (!Generator::contentStore.empty())
+            materialize_link(filename); // don't append to a file shared with other revisions
+        llvm::raw_ostream &myfile = projectManager.appendStream(filename);
+        outputs.push_back(filename);
+        expandedRefs.clear();
+        expandedRefs.reserve(it.second.size());
         for (const auto &it2 : it.second) {
-            clang::SourceRange loc = it2.loc;
-            clang::SourceManager &sm = getSourceMgr();
-            clang::SourceLocation expBegin = sm.getExpansionLoc(loc.getBegin());
-            clang::SourceLocation expEnd = sm.getExpansionLoc(loc.getEnd());
-            std::string fn = htmlNameForFile(sm.getFileID(expBegin));
-            if (fn.empty())
+            clang::SourceLocation expBegin = sm.getExpansionLoc(it2.loc.getBegin());
+            auto decomposed = sm.getDecomposedLoc(expBegin);
+            expandedRefs.push_back({ decomposed.first, decomposed.second, expBegin,
+                                     sm.getExpansionLoc(it2.loc.getEnd()), &it2 });
+        }
+        std::stable_sort(expandedRefs.begin(), expandedRefs.end(),
+                         [](const ExpandedReference &a, const ExpandedReference &b) {
+                             return a.FID < b.FID || (a.FID == b.FID && a.offset < b.offset);
+                         });
+
+        clang::FileID lastFID;
+        const std::string *fn = nullptr;
+        for (const auto &expanded : expandedRefs) {
+            if (!fn || expanded.FID != lastFID) {
+                lastFID = expanded.FID;
+                fn = &escapedNameForFile(expanded.FID);
+            }
+            if (fn->empty())
                 continue;
-            clang::PresumedLoc fixedBegin = sm.getPresumedLoc(expBegin);
-            clang::PresumedLoc fixedEnd = sm.getPresumedLoc(expEnd);
+            const Reference &it2 = *expanded.ref;
+            clang::SourceRange loc = it2.loc;
+            clang::PresumedLoc fixedBegin = sm.getPresumedLoc(expanded.expBegin);
+            clang::PresumedLoc fixedEnd = expanded.expEnd == expanded.expBegin
+                    ? fixedBegin : sm.getPresumedLoc(expanded.expEnd);
             const char *tag = "";
             char usetype = '\0';
             switch(it2.what) {
@@ -401,9 +451,7 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
                 case Inherit:
                     tag = "inh";
             }
-            myfile << "<" << tag << " f='";
-            Generator::escapeAttr(myfile, fn);
-            myfile << "' l='"<<  fixedBegin.getLine()  <<"'";
+            myfile << "<" << tag << " f='" << *fn << "' l='"<<  fixedBegin.getLine()  <<"'";
             if (fixedEnd.isValid() && fixedBegin.getLine() != fixedEnd.getLine())
                 myfile << " ll='"<<  fixedEnd.getLine()  <<"'";
             if (loc.getBegin().isMacroID()) myfile << " macro='1'";
@@ -427,13 +475,10 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
         }
         auto range =  commentHandler.docs.equal_range(it.first);
         for (auto it2 = range.first; it2 != range.second; ++it2) {
-            clang::SourceManager &sm = getSourceMgr();
             clang::SourceLocation exp = sm.getExpansionLoc(it2->second.loc);
             clang::PresumedLoc fixed = sm.getPresumedLoc(exp);
-            std::string fn = htmlNameForFile(sm.getFileID(exp));
-            myfile << "<doc f='";
-            Generator::escapeAttr(myfile, fn);
-            myfile << "' l='" << fixed.getLine() << "'>";
+            myfile << "<doc f='" << escapedNameForFile(sm.getFileID(exp))
+                   << "' l='" << fixed.getLine() << "'>";
             Generator::escapeAttr(myfile, it2->second.content);
             myfile << "</doc>\n";
         }
@@ -488,26 +533,10 @@ bool Annotator::generate(clang::Sema &Sema, bool WasInDatabase)
             llvm::StringRef idxRef(idx, 3); // include the '\0' on purpose
             if (saved.find(idxRef) == std::string::npos) {
                 std::string funcIndexFN = projectManager.outputPrefix % "/fnSearch/" % idx;
-#if CLANG_VERSION_MAJOR==3 && CLANG_VERSION_MINOR<=5
-                std::string error;
-                llvm::raw_fd_ostream funcIndexFile(funcIndexFN.c_str(), error, llvm::sys::fs::F_Append);
-                if (!error.empty()) {
-                    std::cerr << error << std::endl;
-                    return false;
-                }
-#else
-                std::error_code error_code;
-#if CLANG_VERSION_MAJOR >= 13
-                llvm::raw_fd_ostream funcIndexFile(funcIndexFN, error_code, llvm::sys::fs::OF_Append);
-#else
-                llvm::raw_fd_ostream funcIndexFile(funcIndexFN, error_code, llvm::sys::fs::F_Append);
-#endif
-
-                if (error_code) {
-                    std::cerr << "Error writing index file " << funcIndexFN << ": " << error_code.message() << std::endl;
-                    continue;
-                }
-#endif
+                if (!Generator::contentStore.empty())
+                    materialize_link(funcIndexFN);
+                llvm::raw_ostream &funcIndexFile = projectManager.appendStream(funcIndexFN);
+                outputs.push_back(funcIndexFN);
                 funcIndexFile << fnIt.second << '|'<< fnIt.first << '\n';
                 saved.append(idxRef); //include \0;
             }
@@ -587,6 +616,18 @@ static const clang::Decl *getDefinitionDecl(clang::Decl *decl) {
     return decl->getCanonicalDecl();
 }
 
+// The parts of the class of a reference tag, see Annotator::classId
+enum ClassBits {
+    Class_Tu = 1,
+    Class_Def = 1 << 1,
+    Class_Fn = 1 << 2,
+    Class_Field = 1 << 3,
+    Class_Fake = 1 << 4,
+    Class_ColorShift = 5, // 4 bits: 0 if not a local, or the color + 1
+    Class_TypeShift = 9, // 4 bits: the TokenType
+    Class_BaseShift = 13 // the index of the result of computeClas in Annotator::classBases
+};
+
 void Annotator::registerReference(clang::NamedDecl* decl, clang::SourceRange range, Annotator::TokenType type,
                                   Annotator::DeclType declType, std::string typeText,
                                   clang::NamedDecl *usedContext)
@@ -647,8 +688,8 @@ void Annotator::registerReference(clang::NamedDecl* decl, clang::SourceRange ran
     if (!shouldProcess(FID))
         return;
 
-    std::string tags;
-    std::string clas = computeClas(decl);
+    Generator::ReferenceAttributes attributes;
+    unsigned classBits = type << Class_TypeShift;
     std::string ref;
 
     const clang::Decl* canonDecl = decl->getCanonicalDecl();
@@ -664,13 +705,13 @@ void Annotator::registerReference(clang::NamedDecl* decl, clang::SourceRange ran
             ref = (llvm::Twine(id) + name).str();
             if (type != Label) {
                 llvm::SmallString<64> buffer;
-                tags %= " title='" % Generator::escapeAttr(name, buffer) % "'";
-                clas %= " local col" % llvm::Twine(id % 10).str();
+                attributes.title = referenceStrings.intern(Generator::escapeAttr(name, buffer));
+                classBits |= (id % 10 + 1) << Class_ColorShift;
             }
         } else {
             auto cached =  getReferenceAndTitle(decl);
             ref = cached.first;
-            tags %= " title='" % cached.second % "'";
+            attributes.title = referenceStrings.intern(cached.second);
         }
 
         if (visibility == Visibility::Global && type != Typedef) {
@@ -691,7 +732,7 @@ void Annotator::registerReference(clang::NamedDecl* decl, clang::SourceRange ran
         } else {
             if (!typeText.empty()) {
                 llvm::SmallString<64> buffer;
-                tags %= " data-type='" % Generator::escapeAttr(typeText, buffer) % "'";
+                attributes.type = referenceStrings.intern(Generator::escapeAttr(typeText, buffer));
             }
         }
 
@@ -699,38 +740,25 @@ void Annotator::registerReference(clang::NamedDecl* decl, clang::SourceRange ran
             if (declType < Use) {
                 commentHandler.decl_offsets.insert({ decl->getSourceRange().getBegin(), {ref, false} });
             } else switch (+declType) {
-                case Use_Address: tags %= " data-use='a'"; break;
-                case Use_Read: tags %= " data-use='r'"; break;
-                case Use_Write: tags %= " data-use='w'"; break;
-                case Use_Call: tags %= " data-use='c'"; break;
-                case Use_MemberAccess: tags %= " data-use='m'"; break;
+                case Use_Address: attributes.use = 'a'; break;
+                case Use_Read: attributes.use = 'r'; break;
+                case Use_Write: attributes.use = 'w'; break;
+                case Use_Call: attributes.use = 'c'; break;
+                case Use_MemberAccess: attributes.use = 'm'; break;
             }
 
-            clas += " tu";
+            classBits |= Class_Tu;
         }
     }
 
-    switch(type) {
-        case Ref: clas += " ref"; break;
-        case Member: clas += " member"; break;
-        case Type: clas += " type"; break;
-        case Typedef: clas += " typedef"; break;
-        case Decl: clas += " decl"; break;
-        case Call: clas += " call"; break;
-        case Namespace: clas += " namespace"; break;
-        case Enum:  // fall through
-        case EnumDecl: clas += " enum"; break;
-        case Label: clas += " lbl"; break;
-    }
-
     if (declType == Definition && visibility != Visibility::Local) {
-        clas += " def";
+        classBits |= Class_Def;
     }
 
     if (llvm::isa<clang::FunctionDecl>(decl)) {
-        clas += " fn";
+        classBits |= Class_Fn;
     } else if (llvm::isa<clang::FieldDecl>(decl)) {
-        clas += " field";
+        classBits |= Class_Field;
     }
 
 //    const llvm::MemoryBuffer *Buf = sm.getBuffer(FID);
@@ -744,60 +772,100 @@ void Annotator::registerReference(clang::NamedDecl* decl, clang::SourceRange ran
         // Include the whole end token in the range.
         len += clang::Lexer::MeasureTokenLength(E, sm, getLangOpts());
     } else {
-        clas += " fake";
+        classBits |= Class_Fake;
     }
 
     canonDecl = getDefinitionDecl(decl);
 
-    if (clas[0] == ' ') clas = clas.substr(1);
+    attributes.clas = classId(decl, classBits);
 
     if (ref.empty()) {
-        generator(FID).addTag("span", "class=\"" % clas % "\"", pos, len);
+        generator(FID).addTag("span", "class=\"" % referenceStrings[attributes.clas] % "\"", pos, len);
         return;
     }
 
     llvm::SmallString<64> escapedRefBuffer;
-    auto escapedRef = Generator::escapeAttr(ref, escapedRefBuffer);
-    tags %= " data-ref=\"" % escapedRef % "\"";
-
-    // Do some additional escaping for filenames (e.g., ':' is not valid on Windows)
-    llvm::SmallString<64> refFilenameBuffer;
-    auto refFilename = Generator::escapeAttrForFilename(escapedRef, refFilenameBuffer);
-    tags %= " data-ref-filename=\"" % refFilename % "\"";
+    attributes.ref = referenceStrings.intern(Generator::escapeAttr(ref, escapedRefBuffer));
 
     if (declType >= Annotator::Use || (decl != canonDecl && declType != Annotator::Definition) ) {
-        std::string link;
         clang::SourceLocation loc = canonDecl->getLocation();
         clang::FileID declFID = sm.getFileID(sm.getExpansionLoc(loc));
         if (declFID != FID) {
             std::string dataProj;
-            link = pathTo(FID, declFID, &dataProj);
+            std::string link = pathTo(FID, declFID, &dataProj);
 
             if (!dataProj.empty()) {
-                tags %= " data-proj=\"" % dataProj % "\"";
+                attributes.proj = referenceStrings.intern(dataProj);
             }
 
             if (declType < Annotator::Use) {
-                tags %= " id=\"" % escapedRef % "\"";
+                attributes.id = true;
             }
 
             if (link.empty()) {
+                attributes.form = Generator::ReferenceAttributes::Quoted;
                 generator(FID).addTag(declType >= Annotator::Use ? "span" : "dfn",
-                                      "class=\'" % clas % "\'" % tags, pos, len);
+                                      attributes, referenceStrings, pos, len);
                 return;
             }
+            attributes.linkPath = referenceStrings.intern(link);
         }
-        llvm::SmallString<6> locBuffer;
-        link %= "#" % (loc.isFileID() && !decl->isImplicit() ?
-                escapedRef : llvm::Twine(sm.getExpansionLineNumber(loc)).toStringRef(locBuffer));
-        std::string tag = "class=\"" % clas % "\" href=\"" % link % "\"" % tags;
-        generator(FID).addTag("a", tag, pos, len);
+        attributes.form = Generator::ReferenceAttributes::Link;
+        if (loc.isFileID() && !decl->isImplicit())
+            attributes.anchorIsRef = true;
+        else
+            attributes.line = sm.getExpansionLineNumber(loc);
+        generator(FID).addTag("a", attributes, referenceStrings, pos, len);
     } else {
-        std::string tag = "class=\"" % clas % "\" id=\"" % escapedRef % "\"" % tags;
-        generator(FID).addTag("dfn", tag, pos, len);
+        attributes.form = Generator::ReferenceAttributes::Anchor;
+        generator(FID).addTag("dfn", attributes, referenceStrings, pos, len);
     }
 }
 
+unsigned Annotator::classId(clang::NamedDecl *decl, unsigned classBits)
+{
+    std::string base = computeClas(decl);
+    // The results of computeClas are few, index them apart from the referenceStrings
+    // which keep growing with the run
+    uint64_t key = classBits;
+    if (!base.empty())
+        key |= uint64_t(classBases.insert({base, classBases.size() + 1}).first->second) << Class_BaseShift;
+    auto it = classIds.find(key);
+    if (it != classIds.end())
+        return it->second;
+
+    std::string clas = std::move(base);
+    if (unsigned color = (classBits >> Class_ColorShift) & 0xf)
+        clas %= " local col" % llvm::Twine(color - 1).str();
+    if (classBits & Class_Tu)
+        clas += " tu";
+    switch((classBits >> Class_TypeShift) & 0xf) {
+        case Ref: clas += " ref"; break;
+        case Member: clas += " member"; break;
+        case Type: clas += " type"; break;
+        case Typedef: clas += " typedef"; break;
+        case Decl: clas += " decl"; break;
+        case Call: clas += " call"; break;
+        case Namespace: clas += " namespace"; break;
+        case Enum:  // fall through
+        case EnumDecl: clas += " enum"; break;
+        case Label: clas += " lbl"; break;
+    }
+    if (classBits & Class_Def)
+        clas += " def";
+    if (classBits & Class_Fn)
+        clas += " fn";
+    else if (classBits & Class_Field)
+        clas += " field";
+    if (classBits & Class_Fake)
+        clas += " fake";
+
+    if (clas[0] == ' ') clas = clas.substr(1);
+    unsigned id = referenceStrings.intern(clas);
+    classIds.insert({key, id});
+    return id;
+}
+
 void Annotator::addReference(const std::string &ref, clang::SourceRange refLoc, TokenType type,
                              DeclType dt, const std::string &typeRef, clang::Decl *decl)
 {
@@ -935,6 +1003,88 @@ static clang::NamedDecl *getSpecializedCursorTemplate(clang::NamedDecl *D) {
 }
 
 
+namespace {
+/* Identifies a declaration the same way in all the translation units: the file with its size and
+ * modification time, the offset of the name and the kind of declaration, and the predefined
+ * macros of the translation unit. */
+struct DeclIdentity {
+    llvm::sys::fs::UniqueID file;
+    off_t size;
+    time_t modificationTime;
+    unsigned offset;
+    unsigned kind;
+    size_t configuration;
+    bool operator==(const DeclIdentity &o) const {
+        return std::tie(file, size, modificationTime, offset, kind, configuration) ==
+               std::tie(o.file, o.size, o.modificationTime, o.offset, o.kind, o.configuration);
+    }
+};
+struct DeclIdentityHash {
+    size_t operator()(const DeclIdentity &d) const {
+        return llvm::hash_combine(d.file.getDevice(), d.file.getFile(), d.size, d.modificationTime,
+                                  d.offset, d.kind, d.configuration);
+    }
+};
+}
+
+/* DeclIdentity -> reference and title, shared by the translation units of the process.
+ * It only lives as long as the process: the generators run by ninja or in parallel share nothing,
+ * the gain is for the runs processing many translation units (a whole compilation database, the
+ * service). It is not kept on disk keyed by USR and content hash, since computing the USR of
+ * a declaration costs about as much as the mangled name it saves, and since the file identity and
+ * modification time are already a cheap key for the content of the header in this process. */
+static std::unordered_map<DeclIdentity, std::pair<std::string, std::string>, DeclIdentityHash> &sharedReferences()
+{
+    static std::unordered_map<DeclIdentity, std::pair<std::string, std::string>, DeclIdentityHash> references;
+    return references;
+}
+// Beyond that, the map is cleared rather than growing with each new header
+static const size_t MaxSharedReferences = 1 << 20;
+
+void Annotator::clearSharedReferences()
+{
+    sharedReferences().clear();
+}
+
+/* The declarations of template specializations, and the ones depending on template parameters,
+ * are not told apart by their location. Neither are the headers which mean something else
+ * depending on where they are included. */
+bool Annotator::canShareReference(clang::NamedDecl *decl, clang::FileID FID)
+{
+    if (decl->isImplicit() || llvm::isa<clang::ClassTemplateSpecializationDecl>(decl)
+            || llvm::isa<clang::VarTemplateSpecializationDecl>(decl))
+        return false;
+    if (auto *dc = llvm::dyn_cast<clang::DeclContext>(decl)) {
+        if (dc->isDependentContext())
+            return false;
+    }
+    clang::SourceManager &sm = getSourceMgr();
+    for (clang::DeclContext *dc = decl->getDeclContext(); dc; dc = dc->getParent()) {
+        if (llvm::isa<clang::ClassTemplateSpecializationDecl>(dc) || dc->isDependentContext())
+            return false;
+        if (auto *linkage = llvm::dyn_cast<clang::LinkageSpecDecl>(dc)) {
+            // extern "C" { #include ... }
+            if (sm.getFileID(sm.getExpansionLoc(linkage->getLocation())) != FID)
+                return false;
+        }
+    }
+    // The offset in the main file of the #include which lead to the header
+    clang::SourceLocation includeLoc = sm.getIncludeLoc(FID);
+    while (includeLoc.isValid()) {
+        clang::FileID includer = sm.getFileID(includeLoc);
+        if (includer == sm.getMainFileID())
+            return sm.getFileOffset(includeLoc) < firstMainFileMacro;
+        includeLoc = sm.getIncludeLoc(includer);
+    }
+    return false; // included from the predefines (-include), already covered by the configuration
+}
+
+void Annotator::setPreprocessor(clang::Preprocessor &pp)
+{
+    preprocessor = &pp;
+    configurationHash = llvm::hash_value(llvm::StringRef(pp.getPredefines()));
+}
+
 std::pair< std::string, std::string > Annotator::getReferenceAndTitle(clang::NamedDecl* decl)
 {
     clang::Decl* canonDecl = decl->getCanonicalDecl();
@@ -942,7 +1092,36 @@ std::pair< std::string, std::string > Annotator::getReferenceAndTitle(clang::Nam
     if (cached.first.empty()) {
         decl = getSpecializedCursorTemplate(decl);
 
-        std::string qualName = decl->getQualifiedNameAsString();
+        // Only declarations written in a header included once per translation unit can be told
+        // apart by their location. The implicit members and the specializations share the
+        // location of their class or template.
+        DeclIdentity identity;
+        bool shared = false;
+        clang::SourceLocation loc = decl->getLocation();
+        if (preprocessor && loc.isFileID()) {
+            clang::SourceManager &sm = getSourceMgr();
+            auto decomposed = sm.getDecomposedLoc(loc);
+            const clang::FileEntry *fe = sm.getFileEntryForID(decomposed.first);
+            if (fe && decomposed.first != sm.getMainFileID()
+                    && preprocessor->getHeaderSearchInfo().isFileMultipleIncludeGuarded(fe)
+                    && canShareReference(decl, decomposed.first)) {
+                identity = { fe->getUniqueID(), fe->getSize(), fe->getModificationTime(),
+                             decomposed.second, unsigned(decl->getKind()), configurationHash };
+                auto it = sharedReferences().find(identity);
+                if (it != sharedReferences().end()) {
+                    cached = it->second;
+                    return cached;
+                }
+                shared = true;
+            }
+        }
+
+        // Printed once into a buffer rather than with getQualifiedNameAsString
+        llvm::SmallString<128> qualName;
+        {
+            llvm::raw_svector_ostream os(qualName);
+            decl->printQualifiedName(os);
+        }
         if (llvm::isa<clang::FunctionDecl>(decl)
 #if CLANG_VERSION_MAJOR >= 5
                 // We can't mangle a deduction guide (also there is no need since it is not referenced)
@@ -950,7 +1129,7 @@ std::pair< std::string, std::string > Annotator::getReferenceAndTitle(clang::Nam
 #endif
                 && mangle->shouldMangleDeclName(decl)
                 //workaround crash in clang while trying to mangle some builtin types
-                && !llvm::StringRef(qualName).startswith("__")) {
+                && !qualName.startswith("__")) {
             llvm::raw_string_ostream s(cached.first);
             if (llvm::isa<clang::CXXDestructorDecl>(decl)) {
 #if CLANG_VERSION_MAJOR >= 11
@@ -985,12 +1164,16 @@ std::pair< std::string, std::string > Annotator::getReferenceAndTitle(clang::Nam
         } else if (clang::FieldDecl *d = llvm::dyn_cast<clang::FieldDecl>(decl)) {
             cached.first = getReferenceAndTitle(d->getParent()).first + "::" + decl->getName().str();
         } else {
-            cached.first = qualName;
-            cached.first.erase(std::remove(cached.first.begin(), cached.first.end(), ' '),
-                               cached.first.end());
-            // replace < and > because alse jquery can't match them.
-            std::replace(cached.first.begin(), cached.first.end(), '<' , '{');
-            std::replace(cached.first.begin(), cached.first.end(), '>' , '}');
+            cached.first.reserve(qualName.size());
+            for (char c : qualName) {
+                // remove the spaces, and replace < and > because alse jquery can't match them.
+                switch (c) {
+                    case ' ': break;
+                    case '<': cached.first += '{'; break;
+                    case '>': cached.first += '}'; break;
+                    default: cached.first += c; break;
+                }
+            }
         }
         llvm::SmallString<64> buffer;
         cached.second = std::string(Generator::escapeAttr(qualName, buffer));
@@ -1002,6 +1185,11 @@ std::pair< std::string, std::string > Annotator::getReferenceAndTitle(clang::Nam
             buffer.clear();
             cached.first += llvm::Twine(hash).toStringRef(buffer);
         }
+        if (shared) {
+            if (sharedReferences().size() >= MaxSharedReferences)
+                sharedReferences().clear();
+            sharedReferences().insert({identity, cached});
+        }
     }
     return cached;
 }
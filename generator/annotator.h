@@ -22,6 +22,7 @@
 #pragma once
 
 #include <clang/Basic/SourceLocation.h>
+#include <algorithm>
 #include <string>
 #include <map>
 #include <unordered_map>
@@ -78,6 +79,9 @@ private:
     std::map<clang::FileID, std::pair<bool, std::string> > cache;
     std::map<clang::FileID, ProjectInfo* > project_cache;
     std::map<clang::FileID, Generator> generators;
+    Generator::StringTable referenceStrings; // shared by the reference tags of the generators
+    std::unordered_map<uint64_t, unsigned> classIds; // ClassBits -> index in referenceStrings
+    std::unordered_map<std::string, unsigned> classBases; // result of computeClas -> index + 1
 
     std::string htmlNameForFile(clang::FileID id); // keep a cache;
 
@@ -111,9 +115,18 @@ private:
 
     std::map<clang::FileID, std::set<std::string> > interestingDefinitionsInFile;
 
+    // Offsets of the #include directives in each file, in increasing order
+    std::map<clang::FileID, std::vector<unsigned> > inclusionOffsets;
+
+    std::vector<std::string> outputs; // the files written or appended to by generate()
+
     std::string args;
     clang::SourceManager *sourceManager = nullptr;
     const clang::LangOptions *langOption = nullptr;
+    clang::Preprocessor *preprocessor = nullptr;
+    size_t configurationHash = 0; // hash of the predefined macros, see setPreprocessor
+    unsigned firstMainFileMacro = unsigned(-1); // offset of the first #define or #undef of the main file
+    bool canShareReference(clang::NamedDecl *decl, clang::FileID FID);
 
     void syntaxHighlight(Generator& generator, clang::FileID FID, clang::Sema&);
 public:
@@ -125,11 +138,25 @@ public:
     void setSourceMgr(clang::SourceManager &sm, const clang::LangOptions &lo)
     { sourceManager = &sm; langOption = &lo;  }
     void setMangleContext(clang::MangleContext *m) { mangle.reset(m); }
+    /**
+     * The reference and title of the declarations of headers with include guards are shared
+     * with the next translation units which have the same predefined macros.
+     * This assumes that the headers do not depend on what was included before them. The headers
+     * included after a macro was defined in the main file, or within an extern "C" block of an
+     * other file, are not shared.
+     */
+    void setPreprocessor(clang::Preprocessor &pp);
+    // Called by the preprocessor callback for each #define and #undef
+    void registerMainFileMacro(unsigned offset) { firstMainFileMacro = std::min(firstMainFileMacro, offset); }
+    // Forget the shared references, when the file manager is recycled
+    static void clearSharedReferences();
     clang::SourceManager &getSourceMgr() { return *sourceManager; }
     const clang::LangOptions &getLangOpts() const { return *langOption; }
     void setArgs(std::string a) { args = std::move(a); }
 
     bool generate(clang::Sema&, bool WasInDatabase);
+    const std::vector<std::string> &generatedFiles() const { return outputs; }
+    void addOutput(std::string filename) { outputs.push_back(std::move(filename)); }
 
     /**
      * Returns a string with the URL to go from one file to an other.
@@ -172,10 +199,16 @@ public:
     void reportDiagnostic(clang::SourceRange range, const std::string& msg, const std::string& clas);
 
     bool shouldProcess(clang::FileID);
+
+    void registerInclusion(clang::FileID FID, unsigned offset) { inclusionOffsets[FID].push_back(offset); }
+    // Returns true if the file has an #include directive between the two offsets
+    bool hasInclusionBetween(clang::FileID FID, unsigned begin, unsigned end);
     Generator &generator(clang::FileID fid) { return generators[fid]; }
 
     std::string getTypeRef(clang::QualType type);
     std::string computeClas(clang::NamedDecl* decl);
+    /// index in referenceStrings of the class attribute of a reference tag, see ClassBits
+    unsigned classId(clang::NamedDecl* decl, unsigned classBits);
     std::string getContextStr(clang::NamedDecl* usedContext);
     /**
      * returns the reference of a class iff this class is visible
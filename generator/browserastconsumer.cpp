@@ -0,0 +1,219 @@
+/****************************************************************************
+ * Copyright (C) 2012-2016 Woboq GmbH
+ * Olivier Goffart <contact at woboq.com>
+ * https://woboq.com/codebrowser.html
+ *
+ * This file is part of the Woboq Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by Woboq may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and Woboq.
+ * For further information see https://woboq.com/codebrowser.html
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "browserastconsumer.h"
+#include "browserastvisitor.h"
+#include "preprocessorcallback.h"
+#include "projectmanager.h"
+#include "compat.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/Basic/Version.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Lex/Preprocessor.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <iostream>
+
+static std::string locationToString(clang::SourceLocation loc, clang::SourceManager& sm) {
+    clang::PresumedLoc fixed = sm.getPresumedLoc(loc);
+    if (!fixed.isValid())
+        return "???";
+    return (llvm::Twine(fixed.getFilename()) + ":" + llvm::Twine(fixed.getLine())).str();
+}
+
+/* Report the errors and warnings in the generated pages.
+ * In the plugin, the diagnostics are also passed to the client of the compiler ('next') which
+ * prints them and counts the errors. */
+struct BrowserDiagnosticClient : clang::DiagnosticConsumer {
+    Annotator &annotator;
+    clang::DiagnosticConsumer *next;
+    std::unique_ptr<clang::DiagnosticConsumer> ownedNext;
+    BrowserDiagnosticClient(Annotator &fm, clang::DiagnosticConsumer *next = nullptr, bool ownsNext = false)
+        : annotator(fm), next(next), ownedNext(ownsNext ? next : nullptr) {}
+
+    virtual void HandleDiagnostic(clang::DiagnosticsEngine::Level DiagLevel, const clang::Diagnostic& Info) override {
+        if (next) {
+            clang::DiagnosticConsumer::HandleDiagnostic(DiagLevel, Info);
+            next->HandleDiagnostic(DiagLevel, Info);
+        }
+
+        std::string clas;
+        llvm::SmallString<1000> diag;
+        Info.FormatDiagnostic(diag);
+
+        switch(DiagLevel) {
+            case clang::DiagnosticsEngine::Fatal:
+                if (!next)
+                    std::cerr << "FATAL ";
+                LLVM_FALLTHROUGH;
+            case clang::DiagnosticsEngine::Error:
+                if (!next)
+                    std::cerr << "Error: " << locationToString(Info.getLocation(), annotator.getSourceMgr())
+                              << ": " << diag.c_str() << std::endl;
+                clas = "error";
+                break;
+            case clang::DiagnosticsEngine::Warning:
+                clas = "warning";
+                break;
+            default:
+                return;
+        }
+        clang::SourceRange Range = Info.getLocation();
+        annotator.reportDiagnostic(Range, diag.c_str(), clas);
+    }
+
+    virtual void BeginSourceFile(const clang::LangOptions &LangOpts, const clang::Preprocessor *PP) override {
+        if (next)
+            next->BeginSourceFile(LangOpts, PP);
+    }
+    virtual void EndSourceFile() override {
+        if (next)
+            next->EndSourceFile();
+    }
+    virtual void finish() override {
+        if (next)
+            next->finish();
+    }
+};
+
+BrowserASTConsumer::BrowserASTConsumer(clang::CompilerInstance &ci, ProjectManager &projectManager,
+                                       DatabaseType WasInDatabase, bool inPlugin)
+    : clang::ASTConsumer(), ci(ci), annotator(projectManager), WasInDatabase(WasInDatabase), inPlugin(inPlugin)
+{
+    //ci.getLangOpts().DelayedTemplateParsing = (true);
+    // Keep the scope of the translation unit after the parsing, to resolve the references in
+    // the comments. The plugin must not change the compilation, so it does without.
+    if (!inPlugin)
+        ci.getPreprocessor().enableIncrementalProcessing();
+}
+
+BrowserASTConsumer::~BrowserASTConsumer() {
+    if (inPlugin)
+        restoreDiagnosticClient();
+    else
+        ci.getDiagnostics().setClient(new clang::IgnoringDiagConsumer, true);
+}
+
+void BrowserASTConsumer::Initialize(clang::ASTContext& Ctx) {
+    if (inPlugin) {
+        auto mainFile = Ctx.getSourceManager().getFileEntryForID(Ctx.getSourceManager().getMainFileID());
+        annotator.projectManager.beginTranslationUnit(mainFile ? llvm::StringRef(mainFile->getName()) : "<stdin>");
+    }
+    annotator.setSourceMgr(Ctx.getSourceManager(), Ctx.getLangOpts());
+    annotator.setMangleContext(Ctx.createMangleContext());
+    annotator.setPreprocessor(ci.getPreprocessor());
+    ci.getPreprocessor().addPPCallbacks(maybe_unique(new PreprocessorCallback(
+        annotator, ci.getPreprocessor(), WasInDatabase == DatabaseType::ProcessFullDirectory,
+        WasInDatabase == DatabaseType::InDatabase && !inPlugin)));
+    clang::DiagnosticsEngine &diags = ci.getDiagnostics();
+    if (!inPlugin) {
+        diagnosticClient = new BrowserDiagnosticClient(annotator);
+        diags.setClient(diagnosticClient, true);
+        diags.setErrorLimit(0);
+        return;
+    }
+    clang::DiagnosticConsumer *next = diags.getClient();
+    bool ownsNext = diags.ownsClient();
+    if (ownsNext) {
+#if CLANG_VERSION_MAJOR == 3 && CLANG_VERSION_MINOR <= 5
+        diags.takeClient();
+#else
+        diags.takeClient().release();
+#endif
+    }
+    diagnosticClient = new BrowserDiagnosticClient(annotator, next, ownsNext);
+    diags.setClient(diagnosticClient, true);
+}
+
+// Give back the compiler's diagnostic client, for the diagnostics after the annotation.
+void BrowserASTConsumer::restoreDiagnosticClient() {
+    clang::DiagnosticsEngine &diags = ci.getDiagnostics();
+    if (!diagnosticClient || diags.getClient() != diagnosticClient)
+        return;
+    bool ownsNext = diagnosticClient->ownedNext != nullptr;
+    clang::DiagnosticConsumer *next = diagnosticClient->next;
+    diagnosticClient->ownedNext.release();
+    diagnosticClient = nullptr;
+    diags.setClient(next, ownsNext); // deletes our client
+}
+
+bool BrowserASTConsumer::HandleTopLevelDecl(clang::DeclGroupRef D) {
+    // A batch with an error is discarded anyway, the headers are then processed one by one
+    if (!inPlugin && WasInDatabase != DatabaseType::NotInDatabaseBatch
+            && ci.getDiagnostics().hasFatalErrorOccurred()) {
+        // Reset errors: (Hack to ignore the fatal errors.)
+        ci.getDiagnostics().Reset();
+        // When there was fatal error, processing the warnings may cause crashes
+        ci.getDiagnostics().setIgnoreAllWarnings(true);
+    }
+    return true;
+}
+
+std::chrono::steady_clock::duration BrowserASTConsumer::lastRenderTime;
+
+void BrowserASTConsumer::HandleTranslationUnit(clang::ASTContext& Ctx) {
+
+   /* if (PP.getDiagnostics().hasErrorOccurred())
+        return;*/
+    ci.getPreprocessor().getDiagnostics().getClient();
+    if (WasInDatabase == DatabaseType::NotInDatabaseBatch && ci.getDiagnostics().hasErrorOccurred()) {
+        // An error in one header may come from another one of the batch, so only the pages of the
+        // headers parsed on their own have the right diagnostics.
+        std::cerr << "Errors while processing the batch of headers, they will be processed one by one" << std::endl;
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+
+    BrowserASTVisitor v(annotator);
+    v.TraverseDecl(Ctx.getTranslationUnitDecl());
+
+
+    annotator.generate(ci.getSema(), WasInDatabase == DatabaseType::InDatabase
+                                     || WasInDatabase == DatabaseType::ProcessFullDirectory);
+    lastRenderTime = std::chrono::steady_clock::now() - start;
+
+    if (dependencies) {
+        clang::SourceManager &SM = Ctx.getSourceManager();
+        for (auto it = SM.fileinfo_begin(); it != SM.fileinfo_end(); ++it) {
+            llvm::StringRef name = it->first->getName();
+            // The builtin headers embedded in the generator are not on the disk
+            if (!name.empty() && llvm::sys::fs::exists(name))
+                dependencies->inputs.insert(name.str());
+        }
+        const auto &outputs = annotator.generatedFiles();
+        dependencies->outputs.insert(outputs.begin(), outputs.end());
+    }
+
+    if (inPlugin) {
+        annotator.projectManager.commitTranslationUnit();
+        restoreDiagnosticClient();
+    }
+}
+
+bool BrowserASTConsumer::shouldSkipFunctionBody(clang::Decl *D) {
+    return !annotator.shouldProcess(
+        clang::FullSourceLoc(D->getLocation(),annotator.getSourceMgr())
+            .getExpansionLoc().getFileID());
+}
@@ -0,0 +1,80 @@
+/****************************************************************************
+ * Copyright (C) 2012-2016 Woboq GmbH
+ * Olivier Goffart <contact at woboq.com>
+ * https://woboq.com/codebrowser.html
+ *
+ * This file is part of the Woboq Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by Woboq may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and Woboq.
+ * For further information see https://woboq.com/codebrowser.html
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <clang/AST/ASTConsumer.h>
+#include <clang/Basic/Diagnostic.h>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include "annotator.h"
+
+namespace clang {
+class CompilerInstance;
+}
+
+struct ProjectManager;
+struct BrowserDiagnosticClient;
+
+enum class DatabaseType {
+    InDatabase,
+    NotInDatabase,
+    NotInDatabaseBatch, // a generated file including several headers: nothing is generated on errors
+    ProcessFullDirectory
+};
+
+// The files read and written while processing the translation units, for the depfile
+struct DependencyInfo {
+    std::set<std::string> inputs;
+    std::set<std::string> outputs;
+};
+
+/* Consumer that annotates the parsed translation unit and generates the pages.
+ * It is used by the codebrowser_generator, which parses the sources only for that, and by the
+ * clang plugin, which runs it next to the code generation of a real compilation. In that case
+ * (inPlugin), it must not change how the compiler behaves: the diagnostics are still given to
+ * the compiler's own client and the preprocessor is not put in incremental mode. */
+class BrowserASTConsumer : public clang::ASTConsumer
+{
+    clang::CompilerInstance &ci;
+    Annotator annotator;
+    DatabaseType WasInDatabase;
+    bool inPlugin;
+    BrowserDiagnosticClient *diagnosticClient = nullptr;
+    void restoreDiagnosticClient();
+public:
+    BrowserASTConsumer(clang::CompilerInstance &ci, ProjectManager &projectManager,
+                       DatabaseType WasInDatabase, bool inPlugin = false);
+    virtual ~BrowserASTConsumer();
+
+    // If set, filled with the files of this translation unit
+    DependencyInfo *dependencies = nullptr;
+
+    // Time spent annotating and generating the last translation unit (after the parsing)
+    static std::chrono::steady_clock::duration lastRenderTime;
+
+    virtual void Initialize(clang::ASTContext& Ctx) override;
+    virtual bool HandleTopLevelDecl(clang::DeclGroupRef D) override;
+    virtual void HandleTranslationUnit(clang::ASTContext& Ctx) override;
+    virtual bool shouldSkipFunctionBody(clang::Decl *D) override;
+};
@@ -36,7 +36,7 @@
 #include <llvm/Support/SaveAndRestore.h>
 
 #include <iostream>
-#include <deque>
+#include <vector>
 
 struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
     typedef clang::RecursiveASTVisitor<BrowserASTVisitor> Base;
@@ -44,13 +44,37 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
     clang::NamedDecl *currentContext = nullptr;
     int recursionCount = 0; // Used to avoid a stack overflow
     bool isNestedNameSpecifier = false;
-
-    struct : std::deque<clang::Expr *>  {
+    QtMethodIndex qtMethods; // shared by the QtSupport of every call
+
+    // The expressions being traversed, the innermost last. Only the ones from 'base' are the parents
+    // of the current expression: a statement which is not an expression starts a new frame, which
+    // is saved and restored without copying the expressions.
+    struct ExprStack {
+        std::vector<clang::Expr *> exprs;
+        size_t base = 0;
         clang::Expr *topExpr = 0;
         Annotator::DeclType topType = Annotator::Use;
+
+        struct Frame {
+            size_t base;
+            clang::Expr *topExpr;
+            Annotator::DeclType topType;
+        };
+        Frame pushFrame() {
+            Frame saved = { base, topExpr, topType };
+            base = exprs.size();
+            topExpr = 0;
+            topType = Annotator::Use;
+            return saved;
+        }
+        void popFrame(const Frame &saved) {
+            base = saved.base;
+            topExpr = saved.topExpr;
+            topType = saved.topType;
+        }
     } expr_stack;
 
-    BrowserASTVisitor(Annotator &R) : annotator(R) {}
+    BrowserASTVisitor(Annotator &R) : annotator(R) { expr_stack.exprs.reserve(256); }
 
     bool VisitTypedefNameDecl(clang::TypedefNameDecl *d) {
         annotator.registerReference(d, d->getLocation(), Annotator::Typedef, Annotator::Declaration,
@@ -251,12 +275,11 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
                                   Init->isMemberInitializer() ? Annotator::Member : Annotator::Ref,
                                   currentContext, Init->isMemberInitializer() ? Annotator::Use_Write : Annotator::Use);
         }
-        decltype(expr_stack) old_stack;
-        std::swap(expr_stack, old_stack);
+        auto saved = expr_stack.pushFrame();
         expr_stack.topExpr = Init->getInit();
         expr_stack.topType = Annotator::Use_Read;
         Base::TraverseConstructorInitializer(Init);
-        std::swap(expr_stack, old_stack);
+        expr_stack.popFrame(saved);
         return true;
     }
 
@@ -272,7 +295,7 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
                                       Annotator::Ref, currentContext, Annotator::Use_Call);
             }
         }
-        QtSupport qt{annotator, currentContext};
+        QtSupport qt{annotator, currentContext, qtMethods};
         qt.visitCXXConstructExpr(ctr);
         return true;
     }
@@ -294,7 +317,7 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
         }
 
         // support QObject::connect SIGNAL and SLOT
-        QtSupport qt{annotator, currentContext};
+        QtSupport qt{annotator, currentContext, qtMethods};
         qt.visitCallExpr(e);
         return true;
     }
@@ -313,8 +336,37 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
         return true;
     }
 
+    struct Stats {
+        unsigned long long traversed = 0;
+        unsigned long long pruned = 0; // declarations skipped with all their children
+    };
+    static Stats &stats() { static Stats s; return s; }
+
+    /* A declaration which is entirely in a file that is not generated by this translation unit
+     * does not produce anything, as registerReference ignores the locations in such files, so it
+     * does not need to be traversed. Unless a file is included in the middle of it. */
+    bool canPrune(clang::Decl *d) {
+        if (llvm::isa<clang::TranslationUnitDecl>(d))
+            return false;
+        clang::SourceRange range = d->getSourceRange();
+        if (range.isInvalid())
+            return false;
+        clang::SourceManager &sm = annotator.getSourceMgr();
+        clang::SourceLocation begin = sm.getExpansionLoc(range.getBegin());
+        clang::SourceLocation end = sm.getExpansionLoc(range.getEnd());
+        clang::FileID FID = sm.getFileID(begin);
+        if (FID.isInvalid() || FID != sm.getFileID(end) || annotator.shouldProcess(FID))
+            return false;
+        return !annotator.hasInclusionBetween(FID, sm.getFileOffset(begin), sm.getFileOffset(end));
+    }
+
     bool TraverseDecl(clang::Decl *d) {
         if (!d) return true;
+        if (canPrune(d)) {
+            stats().pruned++;
+            return true;
+        }
+        stats().traversed++;
         auto saved = currentContext;
         if (clang::FunctionDecl::classof(d) || clang::RecordDecl::classof(d) ||
             clang::NamespaceDecl::classof(d) || clang::TemplateDecl::classof(d)) {
@@ -341,11 +393,11 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
             return true;
         }
         auto e = llvm::dyn_cast_or_null<clang::Expr>(s);
-        decltype(expr_stack) old_stack;
+        ExprStack::Frame saved = {};
         if (e) {
-            expr_stack.push_front(e);
+            expr_stack.exprs.push_back(e);
         } else {
-            std::swap(old_stack, expr_stack);
+            saved = expr_stack.pushFrame();
             if (auto i = llvm::dyn_cast_or_null<clang::IfStmt>(s)) {
                 expr_stack.topExpr = i->getCond();
                 expr_stack.topType = Annotator::Use_Read;
@@ -371,9 +423,9 @@ struct BrowserASTVisitor : clang::RecursiveASTVisitor<BrowserASTVisitor> {
         }
         auto r = Base::TraverseStmt(s);
         if (e) {
-            expr_stack.pop_front();
+            expr_stack.exprs.pop_back();
         } else {
-            std::swap(old_stack, expr_stack);
+            expr_stack.popFrame(saved);
         }
         recursionCount--;
         return r;
@@ -397,7 +449,8 @@ private:
     Annotator::DeclType classify() {
         bool first = true;
         clang::Expr *previous = nullptr;
-        for (auto expr : expr_stack) {
+        for (size_t depth = expr_stack.exprs.size(); depth > expr_stack.base; --depth) {
+            clang::Expr *expr = expr_stack.exprs[depth - 1];
             if (first) {
                 previous = expr;
                 first = false;
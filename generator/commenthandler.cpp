@@ -36,7 +36,14 @@
 #include <cctype>
 #include <iostream>
 
-clang::NamedDecl *parseDeclarationReference(llvm::StringRef Text, clang::Sema &Sema, bool isFunction) {
+static clang::NamedDecl *parseDeclarationReference(llvm::StringRef Text, clang::Sema &Sema, bool isFunction) {
+
+    auto TuDecl = Sema.getASTContext().getTranslationUnitDecl();
+    // The scope of the translation unit is only kept with the incremental processing, which the
+    // plugin does not enable.
+    clang::Scope *TuScope = Sema.getScopeForContext(TuDecl);
+    if (!TuScope)
+        return nullptr;
 
     clang::Preprocessor &PP = Sema.getPreprocessor();
 
@@ -56,7 +63,6 @@ clang::NamedDecl *parseDeclarationReference(llvm::StringRef Text, clang::Sema &S
     clang::Lexer Lex(FID, Buf2, PP.getSourceManager(), PP.getLangOpts());
 #endif
 
-    auto TuDecl = Sema.getASTContext().getTranslationUnitDecl();
     clang::CXXScopeSpec SS;
     clang::Token Tok, Next;
     Lex.LexFromRawLexer(Tok);
@@ -79,13 +85,13 @@ clang::NamedDecl *parseDeclarationReference(llvm::StringRef Text, clang::Sema &S
                 clang::UnqualifiedId Name;
                 Name.setIdentifier(II, Tok.getLocation());
                 bool dummy;
-                auto TemplateKind = Sema.isTemplateName(Sema.getScopeForContext(TuDecl), SS, false, Name, {}, false, Template, dummy);
+                auto TemplateKind = Sema.isTemplateName(TuScope, SS, false, Name, {}, false, Template, dummy);
                 if (TemplateKind == clang::TNK_Non_template) {
 #if CLANG_VERSION_MAJOR >= 4
                     clang::Sema::NestedNameSpecInfo nameInfo(II, Tok.getLocation(), Next.getLocation());
-                    if (Sema.ActOnCXXNestedNameSpecifier(Sema.getScopeForContext(TuDecl), nameInfo , false, SS))
+                    if (Sema.ActOnCXXNestedNameSpecifier(TuScope, nameInfo , false, SS))
 #else
-                    if (Sema.ActOnCXXNestedNameSpecifier(Sema.getScopeForContext(TuDecl), *II, Tok.getLocation(), Next.getLocation(), {}, false, SS))
+                    if (Sema.ActOnCXXNestedNameSpecifier(TuScope, *II, Tok.getLocation(), Next.getLocation(), {}, false, SS))
 #endif
                     {
                         SS.SetInvalid(Tok.getLocation());
@@ -164,10 +170,25 @@ clang::NamedDecl *parseDeclarationReference(llvm::StringRef Text, clang::Sema &S
     return nullptr;
 }
 
+clang::NamedDecl *CommentHandler::resolveDeclarationReference(llvm::StringRef Text, clang::Sema &Sema,
+                                                              bool isFunction)
+{
+    // The same reference is often repeated (e.g. \fn of overloads or in several comments), and
+    // each parse creates a new FileID.
+    std::string key = (isFunction ? "f" : "d") % Text;
+    auto it = declarationReferences.find(key);
+    if (it != declarationReferences.end())
+        return it->second;
+    auto D = parseDeclarationReference(Text, Sema, isFunction);
+    declarationReferences.emplace(std::move(key), D);
+    return D;
+}
+
 struct CommentHandler::CommentVisitor : clang::comments::ConstCommentVisitor<CommentVisitor>  {
     typedef clang::comments::ConstCommentVisitor<CommentVisitor> Base;
-    CommentVisitor(Annotator &annotator, Generator &generator, const clang::comments::CommandTraits &traits, clang::Sema &Sema)
-        : annotator(annotator), generator(generator) , traits(traits), Sema(Sema) {}
+    CommentVisitor(CommentHandler &handler, Annotator &annotator, Generator &generator, const clang::comments::CommandTraits &traits, clang::Sema &Sema)
+        : handler(handler), annotator(annotator), generator(generator) , traits(traits), Sema(Sema) {}
+    CommentHandler &handler;
     Annotator &annotator;
     Generator &generator;
     const clang::comments::CommandTraits &traits;
@@ -233,7 +254,7 @@ struct CommentHandler::CommentVisitor : clang::comments::ConstCommentVisitor<Com
         std::string ref;
         auto Info = traits.getCommandInfo(C->getCommandID());
         if (Info->IsDeclarationCommand) {
-            auto D = parseDeclarationReference(C->getText(), Sema,
+            auto D = handler.resolveDeclarationReference(C->getText(), Sema,
                 Info->IsFunctionDeclarationCommand || Info->getID() ==  clang::comments::CommandTraits::KCI_fn);
             if (D) {
                 Decl = D;
@@ -368,7 +389,7 @@ void CommentHandler::handleComment(Annotator &A, Generator& generator, clang::Se
         clang::comments::Parser parser(lexer, sema, PP.getPreprocessorAllocator(), PP.getSourceManager(),
                                        PP.getDiagnostics(), traits);
         auto fullComment = parser.parseFullComment();
-        CommentVisitor visitor{A, generator, traits, Sema};
+        CommentVisitor visitor{*this, A, generator, traits, Sema};
         visitor.visit(fullComment);
         if (!visitor.DeclRef.empty()) {
             for (auto &p : visitor.SubDocs)
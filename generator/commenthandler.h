@@ -23,10 +23,12 @@
 
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <clang/Basic/SourceLocation.h>
 
 class Annotator;
 namespace clang {
+class NamedDecl;
 class Preprocessor;
 class Sema;
 }
@@ -57,4 +59,10 @@ public:
                        clang::SourceLocation searchLocBegin, clang::SourceLocation searchLocEnd,
                        clang::SourceLocation commentLoc);
 
+private:
+    // (isFunction + text of a \fn, \class, ... command) -> declaration it refers to, or nullptr.
+    // The declarations belong to the translation unit, so this must not outlive it.
+    std::unordered_map<std::string, clang::NamedDecl *> declarationReferences;
+
+    clang::NamedDecl *resolveDeclarationReference(llvm::StringRef Text, clang::Sema &Sema, bool isFunction);
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+/****************************************************************************
+ * Copyright (C) 2012-2016 Woboq GmbH
+ * Olivier Goffart <contact at woboq.com>
+ * https://woboq.com/codebrowser.html
+ *
+ * This file is part of the Woboq Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by Woboq may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and Woboq.
+ * For further information see https://woboq.com/codebrowser.html
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#include "embeddedfilesystem.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+
+#ifdef CODEBROWSER_COMPRESSED_BUILTINS
+#include <zlib.h>
+#endif
+
+namespace {
+class EmbeddedFileRef : public llvm::vfs::File {
+    llvm::vfs::Status stat;
+    llvm::StringRef data;
+public:
+    EmbeddedFileRef(llvm::vfs::Status stat, llvm::StringRef data) : stat(std::move(stat)), data(data) {}
+    llvm::ErrorOr<llvm::vfs::Status> status() override { return stat; }
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine &name, int64_t,
+                                                                 bool, bool) override {
+        // The content is null terminated and lives as long as the file system
+        return llvm::MemoryBuffer::getMemBuffer(data, stat.getName(), true);
+    }
+    std::error_code close() override { return {}; }
+};
+
+std::string normalize(const llvm::Twine &path, const std::string &workingDirectory) {
+    llvm::SmallString<256> result;
+    path.toVector(result);
+    if (!llvm::sys::path::is_absolute(result, llvm::sys::path::Style::posix) && !workingDirectory.empty()) {
+        llvm::SmallString<256> absolute(workingDirectory);
+        llvm::sys::path::append(absolute, llvm::sys::path::Style::posix, result);
+        result = absolute;
+    }
+    llvm::sys::path::remove_dots(result, true, llvm::sys::path::Style::posix);
+    return std::string(result.str());
+}
+}
+
+EmbeddedFileSystem::EmbeddedFileSystem(const EmbeddedFile *files)
+    : directoryId(llvm::vfs::getNextVirtualUniqueID())
+{
+    for (const EmbeddedFile *f = files; f->filename; ++f) {
+        entries.push_back(Entry{f, llvm::vfs::getNextVirtualUniqueID(), nullptr});
+        llvm::StringRef dir = llvm::sys::path::parent_path(f->filename, llvm::sys::path::Style::posix);
+        // the root is left to the real file system
+        for (; dir.size() > 1; dir = llvm::sys::path::parent_path(dir, llvm::sys::path::Style::posix))
+            directories.push_back(std::string(dir));
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return llvm::StringRef(a.file->filename) < llvm::StringRef(b.file->filename);
+    });
+    std::sort(directories.begin(), directories.end());
+    directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+}
+
+EmbeddedFileSystem::Entry *EmbeddedFileSystem::find(llvm::StringRef path)
+{
+    auto it = std::lower_bound(entries.begin(), entries.end(), path, [](const Entry &e, llvm::StringRef p) {
+        return llvm::StringRef(e.file->filename) < p;
+    });
+    if (it == entries.end() || it->file->filename != path)
+        return nullptr;
+    return &*it;
+}
+
+bool EmbeddedFileSystem::isDirectory(llvm::StringRef path) const
+{
+    return std::binary_search(directories.begin(), directories.end(), path.str());
+}
+
+llvm::vfs::Status EmbeddedFileSystem::statusFor(llvm::StringRef path, const Entry &entry) const
+{
+    return llvm::vfs::Status(path, entry.id, llvm::sys::TimePoint<>(), 0, 0, entry.file->size,
+                             llvm::sys::fs::file_type::regular_file, llvm::sys::fs::all_read);
+}
+
+llvm::StringRef EmbeddedFileSystem::content(const EmbeddedFile *file)
+{
+    if (!file->compressedSize)
+        return llvm::StringRef(file->content, file->size);
+#ifdef CODEBROWSER_COMPRESSED_BUILTINS
+    Entry *entry = find(file->filename);
+    if (!entry)
+        return {};
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!entry->uncompressed) {
+        std::unique_ptr<char[]> data(new char[file->size + 1]);
+        uLongf size = file->size;
+        if (uncompress(reinterpret_cast<Bytef *>(data.get()), &size,
+                       reinterpret_cast<const Bytef *>(file->content), file->compressedSize) != Z_OK
+                || size != file->size) {
+            return {};
+        }
+        data[file->size] = '\0';
+        entry->uncompressed = std::move(data);
+    }
+    return llvm::StringRef(entry->uncompressed.get(), file->size);
+#else
+    return {};
+#endif
+}
+
+llvm::ErrorOr<llvm::vfs::Status> EmbeddedFileSystem::status(const llvm::Twine &path)
+{
+    std::string p = normalize(path, workingDirectory);
+    if (Entry *entry = find(p))
+        return statusFor(p, *entry);
+    if (isDirectory(p)) {
+        return llvm::vfs::Status(p, directoryId, llvm::sys::TimePoint<>(), 0, 0, 0,
+                                 llvm::sys::fs::file_type::directory_file, llvm::sys::fs::all_read);
+    }
+    return std::make_error_code(std::errc::no_such_file_or_directory);
+}
+
+llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> EmbeddedFileSystem::openFileForRead(const llvm::Twine &path)
+{
+    std::string p = normalize(path, workingDirectory);
+    Entry *entry = find(p);
+    if (!entry)
+        return std::make_error_code(std::errc::no_such_file_or_directory);
+    llvm::StringRef data = content(entry->file);
+    if (data.size() != entry->file->size)
+        return std::make_error_code(std::errc::io_error);
+    return std::unique_ptr<llvm::vfs::File>(new EmbeddedFileRef(statusFor(p, *entry), data));
+}
+
+llvm::vfs::directory_iterator EmbeddedFileSystem::dir_begin(const llvm::Twine &, std::error_code &EC)
+{
+    // Listing the directories is not needed to find the headers. (Any other error would
+    // stop the overlay from listing the real directories.)
+    EC = std::make_error_code(std::errc::no_such_file_or_directory);
+    return {};
+}
+
+std::error_code EmbeddedFileSystem::setCurrentWorkingDirectory(const llvm::Twine &path)
+{
+    workingDirectory = path.str();
+    return {};
+}
+
+llvm::ErrorOr<std::string> EmbeddedFileSystem::getCurrentWorkingDirectory() const
+{
+    return workingDirectory;
+}
@@ -0,0 +1,79 @@
+/****************************************************************************
+ * Copyright (C) 2012-2016 Woboq GmbH
+ * Olivier Goffart <contact at woboq.com>
+ * https://woboq.com/codebrowser.html
+ *
+ * This file is part of the Woboq Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by Woboq may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and Woboq.
+ * For further information see https://woboq.com/codebrowser.html
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* A file embedded in the binary (the clang builtin headers). When compressedSize is not 0,
+ * content is compressed with zlib and size is the size of the uncompressed content. */
+struct EmbeddedFile {
+    const char *filename;
+    const char *content;
+    size_t size;
+    size_t compressedSize;
+    template <int N>
+    constexpr EmbeddedFile(const char *filename, const char (&data)[N])
+        : filename(filename) , content(data), size(N-1), compressedSize(0) {}
+    template <int N>
+    constexpr EmbeddedFile(const char *filename, const char (&data)[N], size_t size)
+        : filename(filename) , content(data), size(size), compressedSize(N-1) {}
+    constexpr EmbeddedFile () : filename(nullptr) , content(nullptr), size(0), compressedSize(0) {}
+};
+
+/* Read only file system with the embedded files, to be put in an overlay over the real one.
+ * The files are uncompressed the first time they are opened, and are never copied after that. */
+class EmbeddedFileSystem : public llvm::vfs::FileSystem {
+    struct Entry {
+        const EmbeddedFile *file;
+        llvm::sys::fs::UniqueID id;
+        std::unique_ptr<char[]> uncompressed;
+    };
+    std::vector<Entry> entries; // sorted by file name
+    std::vector<std::string> directories;
+    llvm::sys::fs::UniqueID directoryId;
+    std::string workingDirectory;
+    std::mutex mutex;
+
+    Entry *find(llvm::StringRef path);
+    bool isDirectory(llvm::StringRef path) const;
+    llvm::vfs::Status statusFor(llvm::StringRef path, const Entry &entry) const;
+
+public:
+    /* 'files' is terminated by an EmbeddedFile without a file name */
+    explicit EmbeddedFileSystem(const EmbeddedFile *files);
+
+    /* Returns the uncompressed content of the file (uncompressing it if needed),
+     * or an empty string if the content cannot be uncompressed */
+    llvm::StringRef content(const EmbeddedFile *file);
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &path) override;
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const llvm::Twine &path) override;
+    llvm::vfs::directory_iterator dir_begin(const llvm::Twine &dir, std::error_code &EC) override;
+    std::error_code setCurrentWorkingDirectory(const llvm::Twine &path) override;
+    llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override;
+};
@@ -0,0 +1,93 @@
+/****************************************************************************
+ * Copyright (C) 2012-2016 Woboq GmbH
+ * Olivier Goffart <contact at woboq.com>
+ * https://woboq.com/codebrowser.html
+ *
+ * This file is part of the Woboq Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by Woboq may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and Woboq.
+ * For further information see https://woboq.com/codebrowser.html
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* Build time tool generating embedded_includes.h from embedded_includes.h.in, with the
+ * content of the given headers compressed with zlib.
+ * Usage: codebrowser_embedheaders <template> <output> <headers dir> <headers>... */
+
+#include <zlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static void replaceAll(std::string &str, const std::string &from, const std::string &to) {
+    for (auto pos = str.find(from); pos != std::string::npos; pos = str.find(from, pos + to.size()))
+        str.replace(pos, from.size(), to);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <template> <output> <headers dir> <headers>..." << std::endl;
+        return 1;
+    }
+    std::ifstream templateFile(argv[1]);
+    std::stringstream templ;
+    templ << templateFile.rdbuf();
+    std::string dir = argv[3];
+
+    std::string data;
+    char buf[8];
+    for (int i = 4; i < argc; ++i) {
+        std::string fn = argv[i];
+        std::ifstream in(fn, std::ios::binary);
+        std::stringstream content;
+        content << in.rdbuf();
+        if (!in) {
+            std::cerr << "Cannot read " << fn << std::endl;
+            return 1;
+        }
+        std::string source = content.str();
+        //workaround the fact that stdint.h includes itself
+        replaceAll(source, "__CLANG_STDINT_H", "__CLANG_STDINT_H2");
+
+        uLongf compressedSize = compressBound(source.size());
+        std::vector<Bytef> compressed(compressedSize);
+        if (compress2(compressed.data(), &compressedSize, reinterpret_cast<const Bytef *>(source.data()),
+                      source.size(), Z_BEST_COMPRESSION) != Z_OK) {
+            std::cerr << "Cannot compress " << fn << std::endl;
+            return 1;
+        }
+
+        if (fn.compare(0, dir.size(), dir) == 0)
+            fn = "/builtins" + fn.substr(dir.size());
+        data += " { \"" + fn + "\" , \"";
+        for (uLongf j = 0; j < compressedSize; ++j) {
+            if (j % 64 == 63)
+                data += "\"\n\"";
+            snprintf(buf, sizeof(buf), "\\%03o", compressed[j]);
+            data += buf;
+        }
+        data += "\", " + std::to_string(source.size()) + " } , \n";
+    }
+
+    std::string result = templ.str();
+    replaceAll(result, "@EMBEDDED_DATA@", data);
+    std::ofstream out(argv[2], std::ios::binary);
+    out << result;
+    if (!out) {
+        std::cerr << "Cannot write " << argv[2] << std::endl;
+        return 1;
+    }
+    return 0;
+}
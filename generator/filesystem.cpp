@@ -21,11 +21,13 @@
 
 #include "filesystem.h"
 
-#include <clang/Basic/Version.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/ADT/Twine.h>
 #include <llvm/ADT/SmallString.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <iostream>
 
@@ -34,6 +36,8 @@
 #include <sys/stat.h>
 #else
 #include <windows.h> // MAX_PATH
+#include <process.h> // _getpid
+#define getpid _getpid
 #endif
 
 void make_forward_slashes(char *str)
@@ -57,7 +61,7 @@ void replace_invalid_filename_chars(std::string &str)
 
 std::error_code canonicalize(const llvm::Twine &path, llvm::SmallVectorImpl<char> &result) {
     std::string p = path.str();
-#if CLANG_VERSION_MAJOR>=5
+#if LLVM_VERSION_MAJOR>=5
     llvm::sys::fs::real_path(path, result);
 #else
 #ifdef PATH_MAX
@@ -84,7 +88,7 @@ std::error_code canonicalize(const llvm::Twine &path, llvm::SmallVectorImpl<char
     return {};
 }
 
-#if (CLANG_VERSION_MAJOR>=3 && CLANG_VERSION_MINOR>=8) || CLANG_VERSION_MAJOR>3
+#if (LLVM_VERSION_MAJOR>=3 && LLVM_VERSION_MINOR>=8) || LLVM_VERSION_MAJOR>3
 std::error_code create_directories(const llvm::Twine& path)
 {
     using namespace llvm::sys::fs;
@@ -118,9 +122,9 @@ std::error_code create_directories(const llvm::Twine& path)
     StringRef parent = path::parent_path(p);
     if (!parent.empty()) {
         bool parent_exists;
-#if CLANG_VERSION_MAJOR==3 && CLANG_VERSION_MINOR<=5
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR<=5
         if (auto ec = fs::exists(parent, parent_exists)) {
-#if CLANG_VERSION_MAJOR==3 && CLANG_VERSION_MINOR<=4
+#if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR<=4
             return std::error_code(ec.value(), std::system_category());
 #else
             return ec;
@@ -186,3 +190,55 @@ std::string naive_uncomplete(llvm::StringRef base, llvm::StringRef path) {
         }
     }
 }
+
+std::error_code write_file_atomically(const llvm::Twine &path, llvm::StringRef content)
+{
+    std::string fn = path.str();
+    // The pid makes the temporary name unique among the generators running at the same time
+    std::string tmp = fn + ".tmp" + std::to_string(getpid());
+    {
+        std::error_code error_code;
+#if LLVM_VERSION_MAJOR >= 13
+        llvm::raw_fd_ostream out(tmp, error_code, llvm::sys::fs::OF_None);
+#else
+        llvm::raw_fd_ostream out(tmp, error_code, llvm::sys::fs::F_None);
+#endif
+        if (error_code)
+            return error_code;
+        out << content;
+        out.close();
+        if (out.has_error()) {
+            llvm::sys::fs::remove(tmp);
+            return std::make_error_code(std::errc::io_error);
+        }
+    }
+    if (auto error_code = llvm::sys::fs::rename(tmp, fn)) {
+        llvm::sys::fs::remove(tmp);
+        return error_code;
+    }
+    return {};
+}
+
+std::error_code create_relative_link(llvm::StringRef target, llvm::StringRef link)
+{
+    llvm::SmallString<256> absTarget(target);
+    llvm::SmallString<256> absLink(link);
+    if (auto error_code = llvm::sys::fs::make_absolute(absTarget))
+        return error_code;
+    if (auto error_code = llvm::sys::fs::make_absolute(absLink))
+        return error_code;
+    std::string relative = naive_uncomplete(llvm::sys::path::parent_path(absLink), absTarget);
+    llvm::sys::fs::remove(absLink);
+    return llvm::sys::fs::create_link(relative, absLink);
+}
+
+std::error_code materialize_link(const llvm::Twine &path)
+{
+    std::string fn = path.str();
+    if (!llvm::sys::fs::is_symlink_file(fn))
+        return {};
+    auto content = llvm::MemoryBuffer::getFile(fn);
+    if (!content)
+        return content.getError();
+    return write_file_atomically(fn, content.get()->getBuffer());
+}
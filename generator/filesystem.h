@@ -39,6 +39,16 @@ std::error_code create_directories(const llvm::Twine &path);
 
 std::string naive_uncomplete(llvm::StringRef base, llvm::StringRef path);
 
+/* Write to a temporary file and rename it, so that other processes never see a partial file */
+std::error_code write_file_atomically(const llvm::Twine &path, llvm::StringRef content);
+
+/* Replace 'link' by a symlink to 'target', relative to the directory containing the link */
+std::error_code create_relative_link(llvm::StringRef target, llvm::StringRef link);
+
+/* If path is a symlink, replace it by a regular file with the same content, so it can be
+ * modified without touching the file it was pointing to */
+std::error_code materialize_link(const llvm::Twine &path);
+
 void make_forward_slashes(char *str);
 void make_forward_slashes(std::string &str);
 void replace_invalid_filename_chars(std::string &str);
@@ -30,6 +30,7 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
 #include <clang/Basic/Version.h>
 
 template<int N>
@@ -89,11 +90,51 @@ llvm::StringRef Generator::escapeAttrForFilename(llvm::StringRef s, llvm::SmallV
     return llvm::StringRef(buffer.begin(), buffer.size());
 }
 
-void Generator::Tag::open(llvm::raw_ostream &myfile) const
+void Generator::ReferenceAttributes::render(llvm::raw_ostream &os, const StringTable &strings) const
+{
+    switch (form) {
+        case None:
+            return;
+        case Quoted:
+            os << "class='" << strings[clas] << "'";
+            break;
+        case Link:
+            os << "class=\"" << strings[clas] << "\" href=\"" << strings[linkPath] << '#';
+            if (anchorIsRef)
+                os << strings[ref];
+            else
+                os << line;
+            os << "\"";
+            break;
+        case Anchor:
+            os << "class=\"" << strings[clas] << "\" id=\"" << strings[ref] << "\"";
+            break;
+    }
+    if (title)
+        os << " title='" << strings[title] << "'";
+    if (type)
+        os << " data-type='" << strings[type] << "'";
+    if (use)
+        os << " data-use='" << use << "'";
+    os << " data-ref=\"" << strings[ref] << "\"";
+    // Do some additional escaping for filenames (e.g., ':' is not valid on Windows)
+    llvm::SmallString<64> refFilenameBuffer;
+    os << " data-ref-filename=\"" << escapeAttrForFilename(strings[ref], refFilenameBuffer) << "\"";
+    if (proj)
+        os << " data-proj=\"" << strings[proj] << "\"";
+    if (id)
+        os << " id=\"" << strings[ref] << "\"";
+}
+
+void Generator::Tag::open(llvm::raw_ostream &myfile, const StringTable *strings) const
 {
     myfile << "<" << name;
-    if (!attributes.empty())
+    if (reference.form != ReferenceAttributes::None) {
+        myfile << " ";
+        reference.render(myfile, *strings);
+    } else if (!attributes.empty()) {
         myfile << " " << attributes;
+    }
 
     if (len) {
         myfile << ">";
@@ -109,14 +150,102 @@ void Generator::Tag::close(llvm::raw_ostream &myfile) const
     myfile << "</" << name << ">";
 }
 
+std::string Generator::contentStore;
+
+std::string Generator::contentKey(llvm::StringRef dataPath, const std::string &filename,
+                                  const char* begin, const char* end, llvm::StringRef footer,
+                                  llvm::StringRef project, llvm::StringRef warningMessage,
+                                  const std::set<std::string> &interestingDefinitions) const
+{
+    llvm::SHA1 hasher;
+    // Each part is followed by a '\0' so that two different inputs can't produce the same stream
+    auto add = [&hasher](llvm::StringRef s) {
+        hasher.update(s);
+        hasher.update(llvm::StringRef("", 1));
+    };
+    auto addInt = [&hasher](int i) {
+        hasher.update(llvm::StringRef(reinterpret_cast<const char *>(&i), sizeof(i)));
+    };
+    add(CODEBROWSER_VERSION);
+    add(dataPath);
+    add(filename);
+    // Only the part of the footer that depends on the file: the generation info is loaded
+    // from the project's generation_info.html
+    add(footer);
+    add(project);
+    add(warningMessage);
+    for (const auto &def : interestingDefinitions)
+        add(def);
+    for (const auto &proj : projects) {
+        add(proj.first);
+        add(proj.second);
+    }
+    for (const auto &tag : tags) {
+        addInt(tag.pos);
+        addInt(tag.len);
+        add(tag.name);
+        if (tag.reference.form != ReferenceAttributes::None) {
+            llvm::SmallString<256> rendered;
+            llvm::raw_svector_ostream os(rendered);
+            tag.reference.render(os, *strings);
+            add(os.str());
+        } else {
+            add(tag.attributes);
+        }
+    }
+    hasher.update(llvm::StringRef(begin, end - begin));
+    return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
 void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, const std::string &filename,
-                         const char* begin, const char* end, llvm::StringRef footer, llvm::StringRef warningMessage,
+                         const char* begin, const char* end, llvm::StringRef footer,
+                         llvm::StringRef project, llvm::StringRef generationInfo,
+                         llvm::StringRef warningMessage,
                          const std::set<std::string> &interestingDefinitions)
 {
     std::string real_filename = outputPrefix % "/" % filename % ".html";
     // Make sure the parent directory exist:
     create_directories(llvm::StringRef(real_filename).rsplit('/').first);
 
+    if (!contentStore.empty()) {
+        // Written once per process and project; the content only changes between runs
+        static std::set<std::string> writtenInfos;
+        std::string infoFile = outputPrefix % "/" % project % "/generation_info.html";
+        if (writtenInfos.insert(infoFile).second) {
+            if (auto error_code = write_file_atomically(infoFile, generationInfo)) {
+                std::cerr << "Error generating " << infoFile << " ";
+                std::cerr << error_code.message() << std::endl;
+            }
+        }
+
+        std::string key = contentKey(dataPath, filename, begin, end, footer, project, warningMessage,
+                                     interestingDefinitions);
+        std::string object = contentStore % "/" % llvm::StringRef(key).substr(0, 2) % "/"
+                                          % llvm::StringRef(key).substr(2) % ".html";
+        if (!llvm::sys::fs::exists(object)) {
+            llvm::SmallString<64> buffer;
+            std::string placeholder = "<span id='generation_info' data-project='"
+                % escapeAttr(project, buffer) % "'></span>";
+            std::string page;
+            {
+                llvm::raw_string_ostream myfile(page);
+                render(myfile, dataPath, filename, begin, end, footer, placeholder, warningMessage,
+                       interestingDefinitions);
+            }
+            create_directories(llvm::StringRef(object).rsplit('/').first);
+            if (auto error_code = write_file_atomically(object, page)) {
+                std::cerr << "Error generating " << object << " ";
+                std::cerr << error_code.message() << std::endl;
+                return;
+            }
+        }
+        if (auto error_code = create_relative_link(object, real_filename)) {
+            std::cerr << "Error linking " << real_filename << " ";
+            std::cerr << error_code.message() << std::endl;
+        }
+        return;
+    }
+
 #if CLANG_VERSION_MAJOR==3 && CLANG_VERSION_MINOR<=5
     std::string error;
     llvm::raw_fd_ostream myfile(real_filename.c_str(), error, llvm::sys::fs::F_None);
@@ -138,7 +267,15 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
         return;
     }
 #endif
+    render(myfile, dataPath, filename, begin, end, footer, generationInfo, warningMessage,
+           interestingDefinitions);
+}
 
+void Generator::render(llvm::raw_ostream &myfile, std::string dataPath, const std::string &filename,
+                       const char* begin, const char* end, llvm::StringRef footer,
+                       llvm::StringRef generationInfo, llvm::StringRef warningMessage,
+                       const std::set<std::string> &interestingDefinitions) const
+{
     int count = std::count(filename.begin(), filename.end(), '/');
     std::string root_path = "..";
     for (int i = 0; i < count - 1; i++) {
@@ -246,7 +383,7 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
             assert(c < end);
             while (c == next_start && tags_it != tags.cend()) {
                 assert(c == begin + tags_it->pos);
-                tags_it->open(myfile);
+                tags_it->open(myfile, strings);
                 if (tags_it->len) {
                     stack.push_back(&(*tags_it));
                     next_end =  c + tags_it->len;
@@ -270,7 +407,7 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
                 myfile << "</td></tr>\n"
                           "<tr><th id=\"" << line << "\">"<< line << "</th><td>";
                 for (auto it = stack.cbegin(); it != stack.cend(); ++it)
-                     (*it)->open(myfile);
+                     (*it)->open(myfile, strings);
                 break;
             case '&': flush(); ++bufferStart; myfile << "&amp;"; break;
             case '<': flush(); ++bufferStart; myfile << "&lt;"; break;
@@ -294,6 +431,7 @@ void Generator::generate(llvm::StringRef outputPrefix, std::string dataPath, con
     myfile << "<p id='footer'>\n";
 
     myfile.write(footer.begin(), footer.size());
+    myfile.write(generationInfo.begin(), generationInfo.size());
 
     myfile << "<br />Powered by <a href='https://woboq.com'><img alt='Woboq' src='https://code.woboq.org/woboq-16.png' width='41' height='16' /></a> <a href='https://code.woboq.org'>Code Browser</a> "
               CODEBROWSER_VERSION "\n<br/>Generator usage only permitted with license.</p>\n</div></body></html>\n";
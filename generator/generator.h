@@ -27,6 +27,7 @@
 #include <vector>
 #include <unordered_set>
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
 
 namespace llvm {
 class raw_ostream;
@@ -36,12 +37,57 @@ class raw_ostream;
 /* This class generate the HTML out of a file with the said tags.
  */
 class Generator {
+public:
+    /**
+     * Strings interned once for the reference tags, shared by the generators of a translation
+     * unit. The index 0 stands for no string.
+     */
+    class StringTable {
+        llvm::StringMap<unsigned> indexes;
+        std::vector<llvm::StringRef> strings { llvm::StringRef() };
+    public:
+        unsigned intern(llvm::StringRef s) {
+            auto it = indexes.insert({s, unsigned(strings.size())});
+            if (it.second)
+                strings.push_back(it.first->getKey());
+            return it.first->second;
+        }
+        llvm::StringRef operator[](unsigned index) const { return strings[index]; }
+    };
 
+    /**
+     * The attributes of the tag of a reference to a declaration, as indexes in a StringTable.
+     * They are only rendered to text while the page is written.
+     */
+    struct ReferenceAttributes {
+        enum Form : unsigned char {
+            None,
+            Quoted, // class='..'
+            Link,   // class=".." href="linkPath#ref" or href="linkPath#line"
+            Anchor  // class=".." id="ref"
+        };
+        Form form = None;
+        char use = '\0';          // data-use
+        bool anchorIsRef = false; // whether a link goes to #ref rather than to #line
+        bool id = false;          // also add id="ref" after the other attributes
+        unsigned clas = 0, title = 0, type = 0, ref = 0, proj = 0, linkPath = 0;
+        unsigned line = 0;
+
+        bool operator==(const ReferenceAttributes &o) const {
+            return std::tie(form, use, anchorIsRef, id, clas, title, type, ref, proj, linkPath, line)
+                == std::tie(o.form, o.use, o.anchorIsRef, o.id, o.clas, o.title, o.type, o.ref,
+                            o.proj, o.linkPath, o.line);
+        }
+        void render(llvm::raw_ostream &os, const StringTable &strings) const;
+    };
+
+private:
     struct Tag {
         std::string name;
         std::string attributes;
         int pos;
         int len;
+        ReferenceAttributes reference; // used instead of attributes when its form is not None
         bool operator<(const Tag &other) const {
             //This is the order of the opening tag. Order first by position, then by length
             // (in the reverse order) with the exception of length of 0 which always goes first.
@@ -50,34 +96,69 @@ class Generator {
                                       : len == 0 || (other.len != 0 && len > other.len);
         }
         bool operator==(const Tag &other) const {
-            return std::tie(pos, len, name, attributes) ==
-                   std::tie(other.pos, other.len, other.name, other.attributes);
+            return std::tie(pos, len, name, attributes, reference) ==
+                   std::tie(other.pos, other.len, other.name, other.attributes, other.reference);
         }
-        void open(llvm::raw_ostream& myfile) const;
+        void open(llvm::raw_ostream& myfile, const StringTable *strings) const;
         void close(llvm::raw_ostream& myfile) const;
     };
 
     std::multiset<Tag> tags;
+    const StringTable *strings = nullptr;
+
+    void insertTag(Tag &&t) {
+        auto it = tags.find(t);
+        if (it != tags.end() && *it == t) return; //Hapens in macro for example
+        tags.insert(std::move(t));
+    }
 
     std::map<std::string, std::string> projects;
 
+    std::string contentKey(llvm::StringRef dataPath, const std::string &filename,
+                           const char* begin, const char* end, llvm::StringRef footer,
+                           llvm::StringRef project,
+                           llvm::StringRef warningMessage,
+                           const std::set<std::string> &interestingDefitions) const;
+    void render(llvm::raw_ostream &myfile, std::string dataPath, const std::string &filename,
+                const char* begin, const char* end, llvm::StringRef footer,
+                llvm::StringRef generationInfo, llvm::StringRef warningMessage,
+                const std::set<std::string> &interestingDefitions) const;
+
 public:
+    /**
+     * When not empty, the pages are stored once in this directory, named after the hash of
+     * everything they are generated from, and the output directory only gets relative symlinks
+     * to them. Pages whose hash is already in the store are not rendered again.
+     * The generation info (date, revision) is not part of the stored pages, so that they can be
+     * shared between revisions: it is written once per project in generation_info.html, which
+     * codebrowser.js loads into the footer.
+     */
+    static std::string contentStore;
 
     void addTag(std::string name, std::string attributes, int pos, int len) {
         if (len < 0) {
             return;
         }
-        Tag t = {std::move(name), std::move(attributes), pos, len};
-        auto it = tags.find(t);
-        if (it != tags.end() && *it == t) return; //Hapens in macro for example
-        tags.insert(std::move(t));
+        insertTag({std::move(name), std::move(attributes), pos, len, {}});
+    }
+    /// All the reference tags of a generator must use the same @a strings.
+    void addTag(std::string name, const ReferenceAttributes &reference, const StringTable &strings,
+                int pos, int len) {
+        if (len < 0) {
+            return;
+        }
+        this->strings = &strings;
+        insertTag({std::move(name), {}, pos, len, reference});
     }
     void addProject(std::string a, std::string b) {
         projects.insert({std::move(a), std::move(b) });
     }
 
+    /// @a footer only depends on the file, @a generationInfo on the run of @a project
     void generate(llvm::StringRef outputPrefix, std::string dataPath, const std::string &filename,
-                  const char* begin, const char* end, llvm::StringRef footer, llvm::StringRef warningMessage,
+                  const char* begin, const char* end, llvm::StringRef footer,
+                  llvm::StringRef project, llvm::StringRef generationInfo,
+                  llvm::StringRef warningMessage,
                   const std::set<std::string> &interestingDefitions);
 
     static llvm::StringRef escapeAttr(llvm::StringRef, llvm::SmallVectorImpl<char> &buffer);
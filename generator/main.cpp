@@ -26,23 +26,41 @@
 #include "clang/Tooling/Tooling.h"
 #include "clang/AST/ASTContext.h"
 
+#include <clang/Basic/Version.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
 #include <llvm/ADT/StringSwitch.h>
+#if CLANG_VERSION_MAJOR >= 7
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/StringSaver.h>
+#endif
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <limits>
+#include <map>
+#include <sstream>
 #include <stdexcept>
 #include "annotator.h"
 #include "stringbuilder.h"
+#include "browserastconsumer.h"
 #include "browserastvisitor.h"
-#include "preprocessorcallback.h"
 #include "projectmanager.h"
 #include "filesystem.h"
 #include "compat.h"
 #include <ctime>
 
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 #include "embedded_includes.h"
 
 namespace cl = llvm::cl;
@@ -87,6 +105,74 @@ cl::opt<bool> ProcessAllSources(
     "a",
     cl::desc("Process all files from the compile_commands.json. If this argument is passed, the list of sources does not need to be passed"));
 
+cl::opt<std::string> ContentStore(
+    "content-store",
+    cl::value_desc("store path"),
+    cl::desc("Store the generated pages once in this directory, named after the hash of their content, "
+             "and only put relative symlinks in the output directory. Several revisions can share the same store"),
+    cl::Optional);
+
+cl::opt<bool> ServiceMode(
+    "service",
+    cl::desc("Stay running and process the jobs read from the standard input, one JSON object per line: "
+             "{\"file\": ..., \"directory\": ..., \"arguments\": [...]} (or \"command\": \"...\" instead of "
+             "arguments). A JSON object with the status and the times of each job is written on the standard output"));
+
+cl::opt<std::string> ServiceSocket(
+    "service-socket",
+    cl::value_desc("path"),
+    cl::desc("With --service, read the jobs from the clients of a Unix socket created at this path instead of "
+             "the standard input, and write the replies to them"),
+    cl::Optional);
+
+cl::opt<unsigned> FileCacheBudget(
+    "file-cache-budget",
+    cl::value_desc("megabytes"),
+    cl::desc("Memory budget for long runs: when the memory used by the generator grew by more than "
+             "that since the first translation unit or the last recycling, the file manager is "
+             "replaced by a new one, dropping the cached file and directory entries. 0 (the default) "
+             "means no limit"),
+    cl::init(0));
+
+cl::opt<std::string> DepFile(
+    "depfile",
+    cl::value_desc("file"),
+    cl::desc("Write a Makefile style depfile, as used by make and ninja, listing all the sources and headers "
+             "read while processing the translation units"),
+    cl::Optional);
+
+cl::opt<std::string> DepFileTarget(
+    "depfile-target",
+    cl::value_desc("target"),
+    cl::desc("The target of the rule in the depfile. Defaults to the path of the depfile without its .d extension"),
+    cl::Optional);
+
+cl::opt<std::string> OutputsList(
+    "outputs-list",
+    cl::value_desc("file"),
+    cl::desc("Write the list of the files generated or appended to (pages, refs, search index), one per line"),
+    cl::Optional);
+
+cl::opt<bool> LongestFirst(
+    "longest-first",
+    cl::desc("Process the longest translation units first, according to the time they took in the previous "
+             "runs (recorded in the timings file of the output directory) or to their size, instead of "
+             "processing them in the order of their path. This shortens the runs of several generators "
+             "sharing the output directory, but the translation unit generating each header may change"));
+
+cl::opt<unsigned> BatchHeaders(
+    "batch-headers",
+    cl::value_desc("count"),
+    cl::desc("Parse the headers which are not in the compilation database by groups of up to this count, "
+             "included together by a generated file, instead of one by one. The headers of a group borrow "
+             "the same command. A group with errors is discarded and its headers are parsed one by one. "
+             "Defaults to 1 (no groups)"),
+    cl::init(1));
+
+cl::opt<bool> PrintStats(
+    "print-stats",
+    cl::desc("Print statistics about the caches of the generator"));
+
 cl::extrahelp extra(
 
 R"(
@@ -100,106 +186,6 @@ With a project
   codebrowser_generator -b $PWD/compile_commands.js -a -p codebrowser:$PWD -o ~/public_html/code
 )");
 
-#if 1
-std::string locationToString(clang::SourceLocation loc, clang::SourceManager& sm) {
-    clang::PresumedLoc fixed = sm.getPresumedLoc(loc);
-    if (!fixed.isValid())
-        return "???";
-    return (llvm::Twine(fixed.getFilename()) + ":" + llvm::Twine(fixed.getLine())).str();
-}
-#endif
-
-enum class DatabaseType {
-    InDatabase,
-    NotInDatabase,
-    ProcessFullDirectory
-};
-
-struct BrowserDiagnosticClient : clang::DiagnosticConsumer {
-    Annotator &annotator;
-    BrowserDiagnosticClient(Annotator &fm) : annotator(fm) {}
-
-    virtual void HandleDiagnostic(clang::DiagnosticsEngine::Level DiagLevel, const clang::Diagnostic& Info) override {
-        std::string clas;
-        llvm::SmallString<1000> diag;
-        Info.FormatDiagnostic(diag);
-
-        switch(DiagLevel) {
-            case clang::DiagnosticsEngine::Fatal:
-                std::cerr << "FATAL ";
-                LLVM_FALLTHROUGH;
-            case clang::DiagnosticsEngine::Error:
-                std::cerr << "Error: " << locationToString(Info.getLocation(), annotator.getSourceMgr())
-                            << ": " << diag.c_str() << std::endl;
-                clas = "error";
-                break;
-            case clang::DiagnosticsEngine::Warning:
-                clas = "warning";
-                break;
-            default:
-                return;
-        }
-        clang::SourceRange Range = Info.getLocation();
-        annotator.reportDiagnostic(Range, diag.c_str(), clas);
-    }
-};
-
-class BrowserASTConsumer : public clang::ASTConsumer
-{
-    clang::CompilerInstance &ci;
-    Annotator annotator;
-    DatabaseType WasInDatabase;
-public:
-    BrowserASTConsumer(clang::CompilerInstance &ci, ProjectManager &projectManager, DatabaseType WasInDatabase)
-        : clang::ASTConsumer(), ci(ci), annotator(projectManager), WasInDatabase(WasInDatabase)
-    {
-        //ci.getLangOpts().DelayedTemplateParsing = (true);
-        ci.getPreprocessor().enableIncrementalProcessing();
-    }
-    virtual ~BrowserASTConsumer() {
-	        ci.getDiagnostics().setClient(new clang::IgnoringDiagConsumer, true);
-	 }
-
-    virtual void Initialize(clang::ASTContext& Ctx) override {
-        annotator.setSourceMgr(Ctx.getSourceManager(), Ctx.getLangOpts());
-        annotator.setMangleContext(Ctx.createMangleContext());
-        ci.getPreprocessor().addPPCallbacks(maybe_unique(new PreprocessorCallback(
-            annotator, ci.getPreprocessor(), WasInDatabase == DatabaseType::ProcessFullDirectory)));
-        ci.getDiagnostics().setClient(new BrowserDiagnosticClient(annotator), true);
-        ci.getDiagnostics().setErrorLimit(0);
-    }
-
-    virtual bool HandleTopLevelDecl(clang::DeclGroupRef D) override {
-        if (ci.getDiagnostics().hasFatalErrorOccurred()) {
-            // Reset errors: (Hack to ignore the fatal errors.)
-            ci.getDiagnostics().Reset();
-            // When there was fatal error, processing the warnings may cause crashes
-            ci.getDiagnostics().setIgnoreAllWarnings(true);
-        }
-        return true;
-    }
-
-    virtual void HandleTranslationUnit(clang::ASTContext& Ctx) override {
-
-       /* if (PP.getDiagnostics().hasErrorOccurred())
-            return;*/
-        ci.getPreprocessor().getDiagnostics().getClient();
-
-
-        BrowserASTVisitor v(annotator);
-        v.TraverseDecl(Ctx.getTranslationUnitDecl());
-
-
-        annotator.generate(ci.getSema(), WasInDatabase != DatabaseType::NotInDatabase);
-    }
-
-    virtual bool shouldSkipFunctionBody(clang::Decl *D) override {
-        return !annotator.shouldProcess(
-            clang::FullSourceLoc(D->getLocation(),annotator.getSourceMgr())
-                .getExpansionLoc().getFileID());
-    }
-};
-
 class BrowserAction : public clang::ASTFrontendAction {
     static std::set<std::string> processed;
     DatabaseType WasInDatabase;
@@ -219,22 +205,33 @@ protected:
 
         CI.getFrontendOpts().SkipFunctionBodies = true;
 
-        return maybe_unique(new BrowserASTConsumer(CI, *projectManager, WasInDatabase));
+        auto consumer = new BrowserASTConsumer(CI, *projectManager, WasInDatabase);
+        consumer->dependencies = dependencies;
+        return maybe_unique(consumer);
     }
 
 public:
     BrowserAction(DatabaseType WasInDatabase = DatabaseType::InDatabase) : WasInDatabase(WasInDatabase) {}
     virtual bool hasCodeCompletionSupport() const override { return true; }
+    // So that a file sent again to the service is processed again
+    static void forgetProcessed(const std::string &file) { processed.erase(file); }
     static ProjectManager *projectManager;
+    static DependencyInfo *dependencies;
 };
 
 
 std::set<std::string> BrowserAction::processed;
 ProjectManager *BrowserAction::projectManager = nullptr;
+DependencyInfo *BrowserAction::dependencies = nullptr;
+
+// The builtin headers, shared by all the translation units
+static EmbeddedFileSystem *BuiltinsFS = nullptr;
 
+/* If mainFileContent is not empty, it is the content of the main file, which does not need to
+ * exist on the disk */
 static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Directory,
                            llvm::StringRef file, clang::FileManager *FM,
-                           DatabaseType WasInDatabase) {
+                           DatabaseType WasInDatabase, llvm::StringRef mainFileContent = {}) {
     // This code change all the paths to be absolute paths
     //  FIXME:  it is a bit fragile.
     bool previousIsDashI = false;
@@ -296,13 +293,15 @@ static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Dir
     command.push_back("-Qunused-arguments");
     command.push_back("-Wno-unknown-warning-option");
     clang::tooling::ToolInvocation Inv(command, maybe_unique(new BrowserAction(WasInDatabase)), FM);
+    if (!mainFileContent.empty())
+        Inv.mapVirtualFile(file, mainFileContent);
 
 #if CLANG_VERSION_MAJOR <= 10
     if (!hasNoStdInc) {
       // Map the builtins includes
       const EmbeddedFile *f = EmbeddedFiles;
       while (f->filename) {
-          Inv.mapVirtualFile(f->filename, {f->content , f->size } );
+          Inv.mapVirtualFile(f->filename, BuiltinsFS->content(f));
           f++;
       }
     }
@@ -315,6 +314,492 @@ static bool proceedCommand(std::vector<std::string> command, llvm::StringRef Dir
     return result;
 }
 
+/* The file manager caches the entries of all the files and directories ever looked up, and is
+ * shared by all the translation units. When the memory used grew by more than the budget, it is
+ * replaced by a new one, which fills its cache again with the files that the next translation units use. */
+static void recycleFileManagerIfNeeded(llvm::IntrusiveRefCntPtr<clang::FileManager> &FM,
+                                       llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS) {
+    static int recycled = 0;
+    // The usage after the first translation unit or the last recycling. The other memory of the
+    // process does not grow from one translation unit to the next, so what grew since is mostly
+    // the caches of the file manager and of the shared references.
+    static size_t baseline = 0;
+    if (!FileCacheBudget)
+        return;
+    size_t usage = llvm::sys::Process::GetMallocUsage();
+    if (!baseline) {
+        baseline = usage;
+        return;
+    }
+    if (usage <= baseline + size_t(FileCacheBudget) * 1024 * 1024)
+        return;
+    recycled++;
+    if (PrintStats) {
+        std::cerr << "Memory usage grew by " << ((usage - baseline) / (1024 * 1024)) << " MB, more than the file cache budget, "
+                  << "recycling the file manager (" << recycled << ")" << std::endl;
+        FM->PrintStats();
+    }
+    FM = new clang::FileManager(FM->getFileSystemOpts(), VFS);
+    Annotator::clearSharedReferences();
+    baseline = llvm::sys::Process::GetMallocUsage();
+}
+
+/* The time taken by each translation unit is appended to the timings file of the output directory,
+ * as a line '<parsing ms> <generation ms> <file>'. The last line for a file is the one used. */
+static std::map<std::string, unsigned> loadTimings(const std::string &timingsFile) {
+    std::map<std::string, unsigned> timings;
+    std::ifstream in(timingsFile);
+    std::string line;
+    unsigned lines = 0;
+    while (std::getline(in, line)) {
+        lines++;
+        llvm::StringRef parse, render, file;
+        std::tie(parse, file) = llvm::StringRef(line).split(' ');
+        std::tie(render, file) = file.split(' ');
+        unsigned parseTime, renderTime;
+        if (file.empty() || parse.getAsInteger(10, parseTime) || render.getAsInteger(10, renderTime))
+            continue;
+        timings[std::string(file)] = parseTime + renderTime;
+    }
+    if (lines > 2 * timings.size() + 100) {
+        // Drop the old records
+        std::ostringstream content;
+        for (const auto &it : timings)
+            content << it.second << " 0 " << it.first << '\n';
+        write_file_atomically(timingsFile, content.str());
+    }
+    return timings;
+}
+
+static void recordTiming(const std::string &timingsFile, llvm::StringRef file,
+                         std::chrono::steady_clock::time_point start) {
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    auto total = duration_cast<milliseconds>(std::chrono::steady_clock::now() - start).count();
+    auto render = std::min<long long>(total, duration_cast<milliseconds>(BrowserASTConsumer::lastRenderTime).count());
+    BrowserASTConsumer::lastRenderTime = {};
+    std::ofstream out(timingsFile, std::ios::app);
+    out << std::string(std::to_string(total - render) % " " % std::to_string(render) % " " % file % "\n") << std::flush;
+}
+
+/* Sort the sources by decreasing cost, so that the long translation units do not end up at the
+ * end of the run, where the generators sharing the output directory would wait for them. The
+ * sources which were not processed before are estimated from their size. */
+static void sortLongestFirst(std::vector<std::string> &sources, const std::map<std::string, unsigned> &timings) {
+    std::vector<std::pair<double, std::string>> costs;
+    std::vector<uint64_t> sizes;
+    double knownTime = 0, knownSize = 0;
+    for (const auto &source : sources) {
+        std::string file = clang::tooling::getAbsolutePath(source);
+        uint64_t size = 0;
+        llvm::sys::fs::file_size(file, size);
+        sizes.push_back(size);
+        auto it = timings.find(file);
+        if (it != timings.end()) {
+            knownTime += it->second;
+            knownSize += size;
+        }
+        costs.emplace_back(it != timings.end() ? it->second : -1, source);
+    }
+    double msPerByte = knownSize > 0 ? knownTime / knownSize : 1;
+    for (size_t i = 0; i < costs.size(); ++i) {
+        if (costs[i].first < 0)
+            costs[i].first = sizes[i] * msPerByte;
+    }
+    std::stable_sort(costs.begin(), costs.end(),
+                     [](const std::pair<double, std::string> &a, const std::pair<double, std::string> &b)
+                     { return a.first > b.first; });
+    for (size_t i = 0; i < costs.size(); ++i)
+        sources[i] = std::move(costs[i].second);
+}
+
+// Escape a path for the rules of a Makefile, which is also what ninja reads
+static void writeDepfilePath(std::ostream &out, llvm::StringRef path) {
+    for (char c : path) {
+        if (c == ' ' || c == '#')
+            out << '\\';
+        else if (c == '$')
+            out << '$';
+        out << c;
+    }
+}
+
+static bool writeDependencies(const DependencyInfo &dependencies) {
+    if (!DepFile.empty()) {
+        std::string target = DepFileTarget;
+        if (target.empty()) {
+            target = DepFile;
+            if (llvm::StringRef(target).endswith(".d"))
+                target.resize(target.size() - 2);
+        }
+        std::ostringstream depfile;
+        writeDepfilePath(depfile, target);
+        depfile << ":";
+        for (const auto &input : dependencies.inputs) {
+            depfile << " \\\n  ";
+            writeDepfilePath(depfile, input);
+        }
+        depfile << "\n";
+        if (auto error_code = write_file_atomically(DepFile, depfile.str())) {
+            std::cerr << "Error writing the depfile " << DepFile << ": " << error_code.message() << std::endl;
+            return false;
+        }
+    }
+    if (!OutputsList.empty()) {
+        std::ostringstream list;
+        for (const auto &output : dependencies.outputs)
+            list << output << '\n';
+        if (auto error_code = write_file_atomically(OutputsList, list.str())) {
+            std::cerr << "Error writing the list of outputs " << OutputsList << ": " << error_code.message() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Replaces the arguments of a command of the database which name 'file', as an absolute path or
+ * relative to the directory of the command, by 'replacement'. Returns false if there is none. */
+static bool replaceFileArgument(std::vector<std::string> &command, llvm::StringRef directory,
+                                llvm::StringRef file, const std::string &replacement) {
+    llvm::SmallString<256> canonicalFile;
+    canonicalize(file, canonicalFile);
+    if (canonicalFile.empty())
+        canonicalFile = file;
+    bool replaced = false;
+    for (size_t i = 1; i < command.size(); ++i) {
+        std::string &arg = command[i];
+        if (arg.empty() || arg[0] == '-')
+            continue;
+        llvm::SmallString<256> path(arg);
+        if (!llvm::sys::path::is_absolute(path)) {
+            path = directory;
+            llvm::sys::path::append(path, arg);
+        }
+        llvm::SmallString<256> canonical;
+        canonicalize(path, canonical);
+        if (path == file || (!canonical.empty() && canonical == canonicalFile)) {
+            arg = replacement;
+            replaced = true;
+        }
+    }
+    return replaced;
+}
+
+static bool isHeaderFile(llvm::StringRef filename) {
+    return llvm::StringSwitch<bool>(llvm::sys::path::extension(filename))
+        .Cases(".h", ".H", ".hh", ".hpp", true)
+        .Default(false);
+}
+
+/* Index of the files of the compilation database, to find a command for the files which are
+ * not in it. The trie of their directories gives the file of the database in the closest
+ * directory. 'direct' is the index in 'files' of the first file directly in the directory of
+ * the node, and 'below' of the first file anywhere under it. */
+struct CommandIndex {
+    struct DirectoryNode {
+        llvm::StringMap<unsigned int> children;
+        int direct = -1;
+        int below = -1;
+    };
+    std::vector<DirectoryNode> trie;
+    const std::vector<std::string> &files;
+
+    explicit CommandIndex(const std::vector<std::string> &files) : files(files) {
+        trie.emplace_back();
+        for (int i = 0; i < int(files.size()); ++i) {
+            unsigned int node = 0;
+            llvm::StringRef path = files[i];
+            for (auto slash = path.find('/'); slash != llvm::StringRef::npos; slash = path.find('/')) {
+                if (trie[node].below < 0)
+                    trie[node].below = i;
+                auto inserted = trie[node].children.insert({path.substr(0, slash), trie.size()});
+                if (inserted.second)
+                    trie.emplace_back(); // invalidates 'inserted'
+                node = trie[node].children.lookup(path.substr(0, slash));
+                path = path.substr(slash + 1);
+            }
+            if (trie[node].below < 0)
+                trie[node].below = i;
+            if (trie[node].direct < 0)
+                trie[node].direct = i;
+        }
+    }
+
+    // Returns the file of the database in the directory closest to 'filename', or nullptr
+    const std::string *closestFile(llvm::StringRef filename) const {
+        unsigned int node = 0;
+        for (auto slash = filename.find('/'); slash != llvm::StringRef::npos; slash = filename.find('/')) {
+            auto it = trie[node].children.find(filename.substr(0, slash));
+            if (it == trie[node].children.end())
+                break;
+            node = it->second;
+            filename = filename.substr(slash + 1);
+        }
+        int file = trie[node].direct >= 0 ? trie[node].direct : trie[node].below;
+        return file >= 0 ? &files[file] : nullptr;
+    }
+};
+
+/* Returns the compile commands to use for a file, and sets fileForCommands to the file they were
+ * written for. A file which is not in the database borrows the commands of the first translation
+ * unit which included it, or else of the file of the database in the closest directory. */
+static std::vector<clang::tooling::CompileCommand> findCommandForFile(
+        const clang::tooling::CompilationDatabase &Compilations, const CommandIndex &index,
+        const ProjectManager &projectManager, const std::string &file, std::string &fileForCommands) {
+    auto compileCommandsForFile = Compilations.getCompileCommands(file);
+    fileForCommands = file;
+    if (!compileCommandsForFile.empty())
+        return compileCommandsForFile;
+
+    std::string includer = projectManager.includerOf(file);
+    if (!includer.empty()) {
+        compileCommandsForFile = Compilations.getCompileCommands(includer);
+        if (!compileCommandsForFile.empty()) {
+            fileForCommands = includer;
+            return compileCommandsForFile;
+        }
+    }
+
+    if (const std::string *closest = index.closestFile(file)) {
+        compileCommandsForFile = Compilations.getCompileCommands(*closest);
+        fileForCommands = *closest;
+    }
+    return compileCommandsForFile;
+}
+
+/* The headers which are not in the database and borrow the command of the same file are included
+ * together by a generated file, which is parsed once instead of once per header. The headers for
+ * which no page is generated, because the batch had errors or did not include them, are still
+ * claimed by us and are processed one by one afterwards. */
+static void processHeaderBatches(const std::vector<std::string> &NotInDB,
+                                 const clang::tooling::CompilationDatabase &Compilations,
+                                 const CommandIndex &commandIndex, ProjectManager &projectManager,
+                                 llvm::IntrusiveRefCntPtr<clang::FileManager> &FM,
+                                 llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS) {
+    // file the command was written for -> headers borrowing it, in order
+    std::map<std::string, std::vector<std::string>> groups;
+    for (const auto &file : NotInDB) {
+        if (!isHeaderFile(file) || file.find_first_of("\"\\") != std::string::npos)
+            continue;
+        std::string fileForCommands;
+        if (findCommandForFile(Compilations, commandIndex, projectManager, file, fileForCommands).empty() || fileForCommands == file)
+            continue; // no command, or a header with its own command
+        groups[fileForCommands].push_back(file);
+    }
+
+    int batchNumber = 0;
+    for (const auto &group : groups) {
+        const auto &headers = group.second;
+        for (size_t begin = 0; begin + 1 < headers.size(); begin += BatchHeaders) {
+            std::string batchFile = projectManager.outputPrefix % "/batch-" % std::to_string(++batchNumber) % ".cpp";
+            if (projectManager.projectForFile(batchFile)) {
+                std::cerr << "Not batching the headers: the output directory is in a project" << std::endl;
+                return;
+            }
+            std::string fileForCommands;
+            auto compileCommands = findCommandForFile(Compilations, commandIndex, projectManager, headers[begin], fileForCommands);
+            auto command = compileCommands.front().CommandLine;
+            if (!replaceFileArgument(command, compileCommands.front().Directory, fileForCommands, batchFile))
+                continue; // left to be processed one by one
+            JournalTransaction transaction(projectManager, batchFile);
+
+            std::string content;
+            size_t count = 0;
+            for (size_t i = begin; i < std::min(begin + BatchHeaders, headers.size()); ++i) {
+                const std::string &header = headers[i];
+                auto project = projectManager.projectForFile(header);
+                if (!project || !projectManager.shouldProcess(header, project))
+                    continue;
+                content %= "#include \"" % header % "\"\n";
+                count++;
+            }
+            if (count < 2)
+                continue; // left to be processed alone
+
+            std::cerr << "Processing " << count << " headers together with the command of " << fileForCommands << "\n";
+            proceedCommand(std::move(command), compileCommands.front().Directory, batchFile, FM.get(),
+                           DatabaseType::NotInDatabaseBatch, content);
+            recycleFileManagerIfNeeded(FM, VFS);
+        }
+    }
+}
+
+#if CLANG_VERSION_MAJOR >= 7
+/* Process the jobs read from the standard input, or from the clients of the socket, with the caches
+ * (file manager, builtins, include recovery, claims) kept warm between them.
+ * The outputs of each job are kept, so that a file sent again is generated again after forgetting
+ * them, like ninja does with --outputs-list. The pages generated by other generators, or by the
+ * previous runs, are not generated again: those jobs are skipped. */
+static int runService(ProjectManager &projectManager, llvm::IntrusiveRefCntPtr<clang::FileManager> &FM,
+                      llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS) {
+    std::map<std::string, std::vector<std::string>> jobOutputs; // by file
+    auto runJob = [&](const std::string &line) -> std::string {
+        auto start = std::chrono::steady_clock::now();
+        BrowserASTConsumer::lastRenderTime = {};
+        llvm::json::Object reply;
+        auto finish = [&](llvm::StringRef status) {
+            using std::chrono::duration_cast;
+            using std::chrono::milliseconds;
+            auto total = duration_cast<milliseconds>(std::chrono::steady_clock::now() - start).count();
+            auto render = std::min<long long>(total, duration_cast<milliseconds>(BrowserASTConsumer::lastRenderTime).count());
+            reply["status"] = status;
+            reply["parse_ms"] = total - render;
+            reply["generate_ms"] = render;
+            reply["time_ms"] = total;
+            std::string result;
+            llvm::raw_string_ostream out(result);
+            out << llvm::json::Value(std::move(reply));
+            return out.str();
+        };
+
+        auto parsed = llvm::json::parse(line);
+        if (!parsed) {
+            reply["error"] = llvm::toString(parsed.takeError());
+            return finish("error");
+        }
+        const llvm::json::Object *job = parsed->getAsObject();
+        if (!job) {
+            reply["error"] = "the job is not a JSON object";
+            return finish("error");
+        }
+        if (const llvm::json::Value *id = job->get("id"))
+            reply["id"] = *id;
+        auto file = job->getString("file");
+        if (!file) {
+            reply["error"] = "no file";
+            return finish("error");
+        }
+        reply["file"] = std::string(*file);
+        std::string directory = ".";
+        if (auto dir = job->getString("directory"))
+            directory = std::string(*dir);
+
+        std::vector<std::string> command;
+        if (const llvm::json::Array *arguments = job->getArray("arguments")) {
+            for (const auto &arg : *arguments) {
+                if (auto str = arg.getAsString())
+                    command.push_back(std::string(*str));
+            }
+        } else if (auto commandLine = job->getString("command")) {
+            llvm::BumpPtrAllocator alloc;
+            llvm::StringSaver saver(alloc);
+            llvm::SmallVector<const char *, 64> argv;
+            llvm::cl::TokenizeGNUCommandLine(*commandLine, saver, argv);
+            command.assign(argv.begin(), argv.end());
+        }
+        if (command.empty()) {
+            reply["error"] = "no arguments or command";
+            return finish("error");
+        }
+
+        llvm::SmallString<256> filename;
+        llvm::SmallString<256> absolute(*file);
+        if (!llvm::sys::path::is_absolute(absolute)) {
+            absolute = directory;
+            llvm::sys::path::append(absolute, *file);
+        }
+        canonicalize(absolute, filename);
+        auto project = projectManager.projectForFile(filename);
+        if (!project) {
+            reply["error"] = "file not included by any project";
+            return finish("skipped");
+        }
+        auto previous = jobOutputs.find(std::string(filename.str()));
+        if (previous != jobOutputs.end()) {
+            // Sent again, after a change
+            projectManager.forgetOutputs(previous->second);
+            BrowserAction::forgetProcessed(std::string(filename.str()));
+            jobOutputs.erase(previous);
+        }
+        if (!projectManager.shouldProcess(filename, project)) {
+            reply["error"] = "already generated by another generator or a previous run";
+            return finish("skipped");
+        }
+
+        DependencyInfo dependencies;
+        BrowserAction::dependencies = &dependencies;
+        bool success;
+        {
+            JournalTransaction transaction(projectManager, filename);
+            success = proceedCommand(std::move(command), directory, filename, FM.get(), DatabaseType::InDatabase);
+        }
+        BrowserAction::dependencies = nullptr;
+        jobOutputs[std::string(filename.str())].assign(dependencies.outputs.begin(), dependencies.outputs.end());
+        recycleFileManagerIfNeeded(FM, VFS);
+        return finish(success ? "ok" : "error");
+    };
+
+    if (ServiceSocket.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (llvm::StringRef(line).trim().empty())
+                continue;
+            llvm::outs() << runJob(line) << '\n';
+            llvm::outs().flush();
+        }
+        return EXIT_SUCCESS;
+    }
+
+#ifndef _WIN32
+    // One client at a time, the jobs are processed one after the other anyway
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (ServiceSocket.size() >= sizeof(address.sun_path)) {
+        std::cerr << "The path of the service socket is too long: " << ServiceSocket << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::strcpy(address.sun_path, ServiceSocket.c_str());
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(address.sun_path);
+    if (server < 0 || bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+            || listen(server, 8) != 0) {
+        std::cerr << "Error creating the service socket " << ServiceSocket << ": " << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::signal(SIGPIPE, SIG_IGN); // a client which is gone does not stop the service
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Error accepting a client of the service socket: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        std::string buffer;
+        char chunk[4096];
+        ssize_t size;
+        bool connected = true;
+        while (connected && (size = read(client, chunk, sizeof(chunk))) > 0) {
+            buffer.append(chunk, size);
+            size_t eol;
+            while (connected && (eol = buffer.find('\n')) != std::string::npos) {
+                std::string line = buffer.substr(0, eol);
+                buffer.erase(0, eol + 1);
+                if (llvm::StringRef(line).trim().empty())
+                    continue;
+                std::string reply = runJob(line) + '\n';
+                for (size_t written = 0; written < reply.size(); ) {
+                    ssize_t w = write(client, reply.data() + written, reply.size() - written);
+                    if (w <= 0) {
+                        connected = false;
+                        break;
+                    }
+                    written += w;
+                }
+            }
+        }
+        close(client);
+    }
+    close(server);
+    unlink(address.sun_path);
+    return EXIT_FAILURE;
+#else
+    std::cerr << "The service socket is not supported on Windows" << std::endl;
+    return EXIT_FAILURE;
+#endif
+}
+#endif
+
 int main(int argc, const char **argv) {
     std::string ErrorMessage;
     std::unique_ptr<clang::tooling::CompilationDatabase> Compilations(
@@ -335,38 +820,40 @@ int main(int argc, const char **argv) {
 #endif
 
     ProjectManager projectManager(OutputPath, DataPath);
-    for(std::string &s : ProjectPaths) {
-        auto colonPos = s.find(':');
-        if (colonPos >= s.size()) {
-            std::cerr << "fail to parse project option : " << s << std::endl;
-            continue;
-        }
-        auto secondColonPos = s.find(':', colonPos+1);
-        ProjectInfo info { s.substr(0, colonPos), s.substr(colonPos+1, secondColonPos - colonPos -1),
-            secondColonPos < s.size() ? s.substr(secondColonPos + 1) : std::string() };
-        if (!projectManager.addProject(std::move(info))) {
-            std::cerr << "invalid project directory for : " << s << std::endl;
+    Generator::contentStore = ContentStore;
+    for(std::string &s : ProjectPaths)
+        projectManager.addProjectSpec(s);
+    for(std::string &s : ExternalProjectPaths)
+        projectManager.addExternalProjectSpec(s);
+    BrowserAction::projectManager = &projectManager;
+    DependencyInfo dependencies;
+    if (!DepFile.empty() || !OutputsList.empty())
+        BrowserAction::dependencies = &dependencies;
+    if (!OutputsList.empty()) {
+        // Left by the previous run of the same command, when ninja runs it again after a change
+        if (auto previous = llvm::MemoryBuffer::getFile(OutputsList)) {
+            llvm::SmallVector<llvm::StringRef, 64> lines;
+            (*previous)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+            projectManager.forgetOutputs(std::vector<std::string>(lines.begin(), lines.end()));
         }
     }
-    for(std::string &s : ExternalProjectPaths) {
-        auto colonPos = s.find(':');
-        if (colonPos >= s.size()) {
-            std::cerr << "fail to parse project option : " << s << std::endl;
-            continue;
-        }
-        auto secondColonPos = s.find(':', colonPos+1);
-        if (secondColonPos >= s.size()) {
-            std::cerr << "fail to parse project option : " << s << std::endl;
-            continue;
-        }
-        ProjectInfo info { s.substr(0, colonPos), s.substr(colonPos+1, secondColonPos - colonPos -1),
-            ProjectInfo::External };
-        info.external_root_url = s.substr(secondColonPos + 1);
-        if (!projectManager.addProject(std::move(info))) {
-            std::cerr << "invalid project directory for : " << s << std::endl;
-        }
+
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS(new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem()));
+    llvm::IntrusiveRefCntPtr<clang::FileManager> FM(new clang::FileManager({"."}, VFS));
+
+    // Map the builtins includes
+    llvm::IntrusiveRefCntPtr<EmbeddedFileSystem> EmbeddedFS(new EmbeddedFileSystem(EmbeddedFiles));
+    VFS->pushOverlay(EmbeddedFS);
+    BuiltinsFS = EmbeddedFS.get();
+
+    if (ServiceMode) {
+#if CLANG_VERSION_MAJOR >= 7
+        return runService(projectManager, FM, VFS);
+#else
+        std::cerr << "The service mode requires clang >= 7" << std::endl;
+        return EXIT_FAILURE;
+#endif
     }
-    BrowserAction::projectManager = &projectManager;
 
 
     if (!Compilations && llvm::sys::fs::exists(BuildPath)) {
@@ -397,6 +884,7 @@ int main(int argc, const char **argv) {
     std::vector<std::string> DirContents;
     std::vector<std::string> AllFiles = Compilations->getAllFiles();
     std::sort(AllFiles.begin(), AllFiles.end());
+    CommandIndex commandIndex(AllFiles);
     llvm::ArrayRef<std::string> Sources = SourcePaths;
     if (Sources.empty() && ProcessAllSources) {
         // Because else the order is too random
@@ -446,20 +934,12 @@ int main(int argc, const char **argv) {
         return EXIT_FAILURE;
     }
 
-    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> VFS(new llvm::vfs::OverlayFileSystem(llvm::vfs::getRealFileSystem()));
-    clang::FileManager FM({"."}, VFS);
-    FM.Retain();
-
-    // Map virtual files
-    {
-        auto InMemoryFS = llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem>(new llvm::vfs::InMemoryFileSystem);
-        VFS->pushOverlay(InMemoryFS);
-        // Map the builtins includes
-        const EmbeddedFile *f = EmbeddedFiles;
-        while (f->filename) {
-            InMemoryFS->addFile(f->filename, 0, llvm::MemoryBuffer::getMemBufferCopy(f->content));
-            f++;
-        }
+    std::string TimingsFile = projectManager.outputPrefix + "/timings";
+    std::vector<std::string> OrderedSources;
+    if (LongestFirst) {
+        OrderedSources = Sources.vec();
+        sortLongestFirst(OrderedSources, loadTimings(TimingsFile));
+        Sources = OrderedSources;
     }
 
     int Progress = 0;
@@ -486,16 +966,18 @@ int main(int argc, const char **argv) {
             continue;
         }
 
-        bool isHeader = llvm::StringSwitch<bool>(llvm::sys::path::extension(filename))
-            .Cases(".h", ".H", ".hh", ".hpp", true)
-            .Default(false);
+        bool isHeader = isHeaderFile(filename);
 
         auto compileCommandsForFile = Compilations->getCompileCommands(file);
         if (!compileCommandsForFile.empty() && !isHeader) {
             std::cerr << '[' << (100 * Progress / Sources.size()) << "%] Processing " << file << "\n";
+            JournalTransaction transaction(projectManager, filename);
+            auto start = std::chrono::steady_clock::now();
             proceedCommand(compileCommandsForFile.front().CommandLine,
-                           compileCommandsForFile.front().Directory, file, &FM,
+                           compileCommandsForFile.front().Directory, file, FM.get(),
                            IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory : DatabaseType::InDatabase);
+            recordTiming(TimingsFile, file, start);
+            recycleFileManagerIfNeeded(FM, VFS);
         } else {
             // TODO: Try to find a command line for a file in the same path
             std::cerr << "Delayed " << file << "\n";
@@ -506,6 +988,9 @@ int main(int argc, const char **argv) {
 
     }
 
+    if (BatchHeaders > 1 && !IsProcessingAllDirectory)
+        processHeaderBatches(NotInDB, *Compilations, commandIndex, projectManager, FM, VFS);
+
     for (const auto &it : NotInDB) {
         std::string file = clang::tooling::getAbsolutePath(it);
         Progress++;
@@ -519,36 +1004,36 @@ int main(int argc, const char **argv) {
             std::cerr << "NotInDB: Skipping file not included by any project " << file.c_str() << std::endl;
             continue;
         }
+        JournalTransaction transaction(projectManager, file);
 
         llvm::StringRef similar;
 
-        auto compileCommandsForFile = Compilations->getCompileCommands(file);
-        std::string fileForCommands = file;
-        if (compileCommandsForFile.empty()) {
-            // Find the element with the bigger prefix
-            auto lower = std::lower_bound(AllFiles.cbegin(), AllFiles.cend(), file);
-            if (lower == AllFiles.cend())
-                lower = AllFiles.cbegin();
-            compileCommandsForFile = Compilations->getCompileCommands(*lower);
-            fileForCommands = *lower;
-        }
+        std::string fileForCommands;
+        auto compileCommandsForFile = findCommandForFile(*Compilations, commandIndex, projectManager,
+                                                         file, fileForCommands);
 
         bool success = false;
-        if (!compileCommandsForFile.empty()) {
+        std::vector<std::string> command;
+        if (!compileCommandsForFile.empty())
+            command = compileCommandsForFile.front().CommandLine;
+        if (compileCommandsForFile.empty()) {
+            std::cerr << "Could not find commands for " << file << "\n";
+        } else if (!replaceFileArgument(command, compileCommandsForFile.front().Directory, fileForCommands, it)) {
+            std::cerr << "The command of " << fileForCommands << " does not name it, not using it for " << file << "\n";
+        } else {
             std::cerr << '[' << (100 * Progress / Sources.size()) << "%] Processing " << file << "\n";
-            auto command = compileCommandsForFile.front().CommandLine;
-            std::replace(command.begin(), command.end(), fileForCommands, it);
             if (llvm::StringRef(file).endswith(".qdoc")) {
                 command.insert(command.begin() + 1, "-xc++");
                 // include the header for this .qdoc file
                 command.push_back("-include");
                 command.push_back(llvm::StringRef(file).substr(0, file.size() - 5) % ".h");
             }
+            auto start = std::chrono::steady_clock::now();
             success = proceedCommand(std::move(command), compileCommandsForFile.front().Directory,
-                                     file, &FM,
+                                     file, FM.get(),
                                      IsProcessingAllDirectory ? DatabaseType::ProcessFullDirectory : DatabaseType::NotInDatabase);
-        } else {
-            std::cerr << "Could not find commands for " << file << "\n";
+            recordTiming(TimingsFile, file, start);
+            recycleFileManagerIfNeeded(FM, VFS);
         }
 
         if (!success && !IsProcessingAllDirectory) {
@@ -563,10 +1048,10 @@ int main(int argc, const char **argv) {
             char buf[80];
             std::strftime(buf, sizeof(buf), "%Y-%b-%d", tm);
 
-            std::string footer = "Generated on <em>" % std::string(buf) % "</em>"
+            std::string generationInfo = "Generated on <em>" % std::string(buf) % "</em>"
                                 % " from project " % projectinfo->name % "</a>";
             if (!projectinfo->revision.empty())
-                footer %= " revision <em>" % projectinfo->revision % "</em>";
+                generationInfo %= " revision <em>" % projectinfo->revision % "</em>";
 
 #if CLANG_VERSION_MAJOR == 3 && CLANG_VERSION_MINOR <= 4
             llvm::OwningPtr<llvm::MemoryBuffer> Buf;
@@ -583,16 +1068,29 @@ int main(int argc, const char **argv) {
 
             Generator g;
             g.generate(projectManager.outputPrefix, projectManager.dataPath, fn,
-                       Buf->getBufferStart(), Buf->getBufferEnd(), footer,
+                       Buf->getBufferStart(), Buf->getBufferEnd(), {},
+                       projectinfo->name, generationInfo,
                        "Warning: This file is not a C or C++ file. It does not have highlighting.",
                        std::set<std::string>());
-
-            std::ofstream fileIndex;
-            fileIndex.open(projectManager.outputPrefix + "/otherIndex", std::ios::app);
-            if (!fileIndex)
-                continue;
-            fileIndex << fn << '\n';
+            projectManager.markGenerated(fn);
+            dependencies.inputs.insert(file);
+            dependencies.outputs.insert(projectManager.outputPrefix % "/" % fn % ".html");
+            if (!Generator::contentStore.empty())
+                dependencies.outputs.insert(projectManager.outputPrefix % "/" % projectinfo->name % "/generation_info.html");
+
+            projectManager.appendStream(projectManager.outputPrefix + "/otherIndex") << fn << '\n';
+            dependencies.outputs.insert(projectManager.outputPrefix + "/otherIndex");
         }
     }
+
+    if (BrowserAction::dependencies && !writeDependencies(dependencies))
+        return EXIT_FAILURE;
+
+    if (PrintStats) {
+        std::cerr << "Declarations traversed: " << BrowserASTVisitor::stats().traversed
+                  << ", skipped in files without output: " << BrowserASTVisitor::stats().pruned << std::endl;
+        std::cerr << "Memory usage: " << (llvm::sys::Process::GetMallocUsage() / (1024 * 1024)) << " MB" << std::endl;
+        FM->PrintStats();
+    }
 }
 
@@ -0,0 +1,108 @@
+/****************************************************************************
+ * Copyright (C) 2012-2016 Woboq GmbH
+ * Olivier Goffart <contact at woboq.com>
+ * https://woboq.com/codebrowser.html
+ *
+ * This file is part of the Woboq Code Browser.
+ *
+ * Commercial License Usage:
+ * Licensees holding valid commercial licenses provided by Woboq may use
+ * this file in accordance with the terms contained in a written agreement
+ * between the licensee and Woboq.
+ * For further information see https://woboq.com/codebrowser.html
+ *
+ * Alternatively, this work may be used under a Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 (CC-BY-NC-SA 3.0) License.
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/deed.en_US
+ * This license does not allow you to use the code browser to assist the
+ * development of your commercial software. If you intent to do so, consider
+ * purchasing a commercial licence.
+ ****************************************************************************/
+
+/* The code browser as a clang plugin: the pages are generated as a side effect of the real
+ * compilation, instead of parsing the sources a second time with codebrowser_generator.
+ *
+ *   clang++ -fplugin=/path/to/codebrowser_plugin.so \
+ *       -Xclang -plugin-arg-codebrowser -Xclang o=/path/to/output \
+ *       -Xclang -plugin-arg-codebrowser -Xclang p=projectname:/path/to/source:revision ...
+ *
+ * The arguments are the same as the ones of codebrowser_generator, given as key=value:
+ * o (the output directory, required), p and e (several times), d and content-store.
+ */
+
+#include "browserastconsumer.h"
+#include "generator.h"
+#include "projectmanager.h"
+#include "compat.h"
+
+#include <clang/Basic/Version.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendPluginRegistry.h>
+
+#include <iostream>
+
+class BrowserPluginAction : public clang::PluginASTAction {
+    // One compiler process only compiles one translation unit, but keep the projects and the
+    // claims for the whole process, like codebrowser_generator does.
+    static std::unique_ptr<ProjectManager> projectManager;
+protected:
+#if CLANG_VERSION_MAJOR == 3 && CLANG_VERSION_MINOR <= 5
+    virtual clang::ASTConsumer *
+#else
+    virtual std::unique_ptr<clang::ASTConsumer>
+#endif
+    CreateASTConsumer(clang::CompilerInstance &CI, llvm::StringRef InFile) override {
+        return maybe_unique(new BrowserASTConsumer(CI, *projectManager, DatabaseType::InDatabase, true));
+    }
+
+    virtual bool ParseArgs(const clang::CompilerInstance &CI, const std::vector<std::string> &args) override {
+        if (projectManager)
+            return true;
+        std::string outputPath, dataPath, contentStore;
+        std::vector<std::string> projects, externalProjects;
+        for (const std::string &arg : args) {
+            auto equalPos = arg.find('=');
+            if (equalPos >= arg.size()) {
+                std::cerr << "codebrowser: fail to parse plugin argument : " << arg << std::endl;
+                return false;
+            }
+            llvm::StringRef key = llvm::StringRef(arg).substr(0, equalPos);
+            std::string value = arg.substr(equalPos + 1);
+            if (key == "o")
+                outputPath = value;
+            else if (key == "d")
+                dataPath = value;
+            else if (key == "p")
+                projects.push_back(value);
+            else if (key == "e")
+                externalProjects.push_back(value);
+            else if (key == "content-store")
+                contentStore = value;
+            else {
+                std::cerr << "codebrowser: unknown plugin argument : " << arg << std::endl;
+                return false;
+            }
+        }
+        if (outputPath.empty()) {
+            std::cerr << "codebrowser: the output directory must be given with the plugin argument o=<output path>" << std::endl;
+            return false;
+        }
+        projectManager.reset(new ProjectManager(outputPath, dataPath));
+        Generator::contentStore = contentStore;
+        for (const std::string &s : projects)
+            projectManager->addProjectSpec(s);
+        for (const std::string &s : externalProjects)
+            projectManager->addExternalProjectSpec(s);
+        return true;
+    }
+
+#if CLANG_VERSION_MAJOR >= 5
+    // Run with -fplugin, next to the code generation
+    virtual ActionType getActionType() override { return AddAfterMainAction; }
+#endif
+};
+
+std::unique_ptr<ProjectManager> BrowserPluginAction::projectManager;
+
+static clang::FrontendPluginRegistry::Add<BrowserPluginAction>
+    X("codebrowser", "generate the code browser pages of the compiled sources");
@@ -27,22 +27,32 @@
 #include <clang/Basic/FileManager.h>
 #include <clang/Basic/Version.h>
 #include <llvm/ADT/Twine.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
 #include "stringbuilder.h"
 #include "projectmanager.h"
+#include "filesystem.h"
+#include <algorithm>
+#include <iostream>
 
 
 void PreprocessorCallback::MacroExpands(const clang::Token& MacroNameTok,
                                         MyMacroDefinition MD,
                                         clang::SourceRange Range, const clang::MacroArgs *)
 {
-    if (disabled)
-        return;
-
 #if CLANG_VERSION_MAJOR != 3 || CLANG_VERSION_MINOR >= 7
     auto *MI = MD.getMacroInfo();
 #else
     auto *MI = MD->getMacroInfo();
 #endif
+    if (disabled) {
+        // Expanded by expandMacro
+        if (MI && MI->isBuiltinMacro())
+            expansionUsesBuiltin = true;
+        else
+            expansionDependencies.emplace_back(MacroNameTok.getIdentifierInfo(), MI);
+        return;
+    }
     clang::SourceLocation loc = MacroNameTok.getLocation();
     if (!loc.isValid() || !loc.isFileID())
         return;
@@ -56,8 +66,73 @@ void PreprocessorCallback::MacroExpands(const clang::Token& MacroNameTok,
     len += clang::Lexer::MeasureTokenLength(Range.getEnd(), sm, PP.getLangOpts());
 
     std::string copy(begin, len);
-    begin = copy.c_str();
-    clang::Lexer lex(loc, PP.getLangOpts(), begin, begin, begin + len);
+    // The same macros are often expanded with the same arguments. The expansion is reused as long
+    // as neither the macro nor the macros it expanded to were redefined, and no identifier of the
+    // result became a macro.
+    std::string cacheKey = std::string(reinterpret_cast<const char *>(&MI), sizeof(MI)) + copy;
+    auto cached = expansionCache.find(cacheKey);
+    if (cached != expansionCache.end()) {
+        for (const auto &dependency : cached->second.dependencies) {
+            if (PP.getMacroInfo(dependency.first) != dependency.second) {
+                expansionCache.erase(cached);
+                cached = expansionCache.end();
+                break;
+            }
+        }
+    }
+    CachedExpansion uncached;
+    const CachedExpansion *expansionInfo = &uncached;
+    if (cached == expansionCache.end()) {
+        expansionDependencies.clear();
+        expansionUsesBuiltin = false;
+        std::string expansion = expandMacro(copy, loc);
+        uncached.attributes = expansionAttributes(expansion, uncached.file);
+        if (!expansionUsesBuiltin) {
+            std::sort(expansionDependencies.begin(), expansionDependencies.end());
+            expansionDependencies.erase(std::unique(expansionDependencies.begin(), expansionDependencies.end()),
+                                        expansionDependencies.end());
+            uncached.dependencies = std::move(expansionDependencies);
+            expansionInfo = &expansionCache.insert({std::move(cacheKey), std::move(uncached)}).first->second;
+        }
+    } else {
+        expansionInfo = &cached->second;
+    }
+    if (!expansionInfo->file.empty() && expansionFiles.insert(expansionInfo->file).second)
+        annotator.addOutput(expansionInfo->file);
+    const std::string &expansionAttrs = expansionInfo->attributes;
+
+    std::string ref = llvm::Twine("_M/", MacroNameTok.getIdentifierInfo()->getName()).str();
+
+    clang::SourceLocation defLoc = MI->getDefinitionLoc();
+    clang::FileID defFID = sm.getFileID(defLoc);
+    std::string link;
+    std::string dataProj;
+    if (defFID != FID) {
+        link = annotator.pathTo(FID, defFID, &dataProj);
+        if (link.empty()) {
+            std::string tag = "class=\"macro\"" % expansionAttrs % " data-ref=\"" % ref % "\"";
+            annotator.generator(FID).addTag("span", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
+            return;
+        }
+
+        if (!dataProj.empty()) {
+            dataProj = " data-proj=\"" % dataProj % "\"";
+        }
+    }
+
+    if (sm.getMainFileID() != defFID) {
+        annotator.registerMacro(ref, MacroNameTok.getLocation(), Annotator::Use_Call);
+    }
+
+    std::string tag = "class=\"macro\" href=\"" % link % "#" % llvm::Twine(sm.getExpansionLineNumber(defLoc)).str()
+        % "\"" % expansionAttrs % " data-ref=\"" % ref % "\"" % dataProj;
+    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
+}
+
+std::string PreprocessorCallback::expandMacro(const std::string &invocation, clang::SourceLocation loc)
+{
+    const char *begin = invocation.c_str();
+    clang::Lexer lex(loc, PP.getLangOpts(), begin, begin, begin + invocation.size());
     std::vector<clang::Token> tokens;
     std::string expansion;
 
@@ -133,6 +208,9 @@ void PreprocessorCallback::MacroExpands(const clang::Token& MacroNameTok,
            // ConcatInfo.AvoidConcat(PrevPrevTok, PrevTok, Tok)) //FIXME
         // Escape any special characters in the token text.
         expansion += PP.getSpelling(tok);
+        // Would be expanded if it became a macro
+        if (auto *II = tok.getIdentifierInfo())
+            expansionDependencies.emplace_back(II, PP.getMacroInfo(II));
 
         if (expansion.size() >= 30 * 1000) {
             // Don't let the macro expansion grow too large.
@@ -148,36 +226,31 @@ void PreprocessorCallback::MacroExpands(const clang::Token& MacroNameTok,
     PP.setDiagnostics(*OldDiags);
     PP.setPragmasEnabled(pragmasPreviouslyEnabled);
     disabled = false;
+    return expansion;
+}
 
-    std::string ref = llvm::Twine("_M/", MacroNameTok.getIdentifierInfo()->getName()).str();
-
-    clang::SourceLocation defLoc = MI->getDefinitionLoc();
-    clang::FileID defFID = sm.getFileID(defLoc);
+/* The small expansions are put in the title of the macro. The bigger ones (Q_OBJECT, ...) are
+ * written once in the macros directory of the output, named after the hash of their content, and
+ * fetched by the page when the macro is hovered. */
+std::string PreprocessorCallback::expansionAttributes(const std::string &expansion, std::string &file)
+{
     llvm::SmallString<128> expansionBuffer;
-    std::string link;
-    std::string dataProj;
-    if (defFID != FID) {
-        link = annotator.pathTo(FID, defFID, &dataProj);
-        if (link.empty()) {
-            std::string tag = "class=\"macro\" title=\"" % Generator::escapeAttr(expansion, expansionBuffer)
-                % "\" data-ref=\"" % ref % "\"";
-            annotator.generator(FID).addTag("span", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
-            return;
-        }
-
-        if (!dataProj.empty()) {
-            dataProj = " data-proj=\"" % dataProj % "\"";
-        }
-    }
-
-    if (sm.getMainFileID() != defFID) {
-        annotator.registerMacro(ref, MacroNameTok.getLocation(), Annotator::Use_Call);
+    if (expansion.size() < 512)
+        return " title=\"" % Generator::escapeAttr(expansion, expansionBuffer) % "\"";
+
+    llvm::SHA1 hasher;
+    hasher.update(expansion);
+    std::string hash = llvm::toHex(hasher.final(), /*LowerCase=*/true);
+
+    std::string dir = annotator.projectManager.outputPrefix + "/macros";
+    file = dir % "/" % hash;
+    if (annotator.projectManager.needsWrite(file)) {
+        create_directories(dir);
+        annotator.projectManager.journalWrite(file);
+        if (auto error_code = write_file_atomically(file, expansion))
+            std::cerr << "Error writing the macro expansion " << file << ": " << error_code.message() << std::endl;
     }
-
-    std::string tag = "class=\"macro\" href=\"" % link % "#" % llvm::Twine(sm.getExpansionLineNumber(defLoc)).str()
-        % "\" title=\"" % Generator::escapeAttr(expansion, expansionBuffer)
-        % "\" data-ref=\"" % ref % "\"" % dataProj;
-    annotator.generator(FID).addTag("a", tag, sm.getFileOffset(loc), MacroNameTok.getLength());
+    return " data-expansion=\"" % hash % "\"";
 }
 
 void PreprocessorCallback::MacroDefined(const clang::Token& MacroNameTok, const clang::MacroDirective *MD)
@@ -188,6 +261,8 @@ void PreprocessorCallback::MacroDefined(const clang::Token& MacroNameTok, const
 
     clang::SourceManager &sm = annotator.getSourceMgr();
     clang::FileID FID = sm.getFileID(loc);
+    if (FID == sm.getMainFileID())
+        annotator.registerMainFileMacro(sm.getFileOffset(loc));
     if (!annotator.shouldProcess(FID))
         return;
 
@@ -212,6 +287,8 @@ void PreprocessorCallback::MacroUndefined(const clang::Token& MacroNameTok, Prep
 
     clang::SourceManager &sm = annotator.getSourceMgr();
     clang::FileID FID = sm.getFileID(loc);
+    if (FID == sm.getMainFileID())
+        annotator.registerMainFileMacro(sm.getFileOffset(loc));
     if (!annotator.shouldProcess(FID))
         return;
 
@@ -292,7 +369,20 @@ void PreprocessorCallback::InclusionDirective(clang::SourceLocation HashLoc, con
     if (!HashLoc.isValid() || !HashLoc.isFileID() || !File)
         return;
     clang::SourceManager &sm = annotator.getSourceMgr();
+    if (recordIncluders) {
+        if (const clang::FileEntry *mainFile = sm.getFileEntryForID(sm.getMainFileID())) {
+#if CLANG_VERSION_MAJOR >= 7
+            llvm::StringRef name = File->tryGetRealPathName();
+            if (name.empty())
+                name = File->getName();
+#else
+            llvm::StringRef name = File->getName();
+#endif
+            annotator.projectManager.recordInclusion(File->getUniqueID(), name, mainFile->getName());
+        }
+    }
     clang::FileID FID = sm.getFileID(HashLoc);
+    annotator.registerInclusion(FID, sm.getFileOffset(HashLoc));
     if (!annotator.shouldProcess(FID))
         return;
 
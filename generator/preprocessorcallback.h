@@ -25,6 +25,10 @@
 #include <clang/Lex/MacroInfo.h>
 #include <clang/Basic/Version.h>
 #include <clang/AST/Decl.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace clang {
 class Preprocessor;
@@ -38,10 +42,13 @@ class PreprocessorCallback  : public clang::PPCallbacks {
     bool disabled = false; // To prevent recurstion
     bool seenPragma = false; // To detect _Pragma in expansion
     bool recoverIncludePath; // If we should try to find the include paths harder
+    bool recordIncluders; // If the included files are recorded in ProjectManager::recordInclusion
 
 public:
-    PreprocessorCallback(Annotator &fm, clang::Preprocessor &PP, bool recoverIncludePath)
-        : annotator(fm), PP(PP), recoverIncludePath(recoverIncludePath) {}
+    PreprocessorCallback(Annotator &fm, clang::Preprocessor &PP, bool recoverIncludePath,
+                         bool recordIncluders = false)
+        : annotator(fm), PP(PP), recoverIncludePath(recoverIncludePath),
+          recordIncluders(recordIncluders) {}
 
 #if CLANG_VERSION_MAJOR != 3 || CLANG_VERSION_MINOR >= 7
     using MyMacroDefinition = const clang::MacroDefinition &;
@@ -98,4 +105,20 @@ public:
 private:
     std::map<clang::SourceLocation, clang::SourceLocation> ElifMapping;     // Map an elif location to the real if;
     void HandlePPCond(clang::SourceLocation Loc, clang::SourceLocation IfLoc);
+
+    // The macros an expansion depends on, with the definition they had when it was computed
+    using MacroDependencies = std::vector<std::pair<const clang::IdentifierInfo *, const clang::MacroInfo *>>;
+    struct CachedExpansion {
+        std::string attributes;
+        std::string file; // in the macros directory, for the big expansions
+        MacroDependencies dependencies;
+    };
+    // By definition and spelling of the invocation. The expansions using builtin macros such
+    // as __LINE__ or __COUNTER__ are not cached.
+    std::unordered_map<std::string, CachedExpansion> expansionCache;
+    std::unordered_set<std::string> expansionFiles; // referenced by this translation unit
+    MacroDependencies expansionDependencies; // filled by expandMacro
+    bool expansionUsesBuiltin = false;       // set by expandMacro
+    std::string expandMacro(const std::string &invocation, clang::SourceLocation loc);
+    std::string expansionAttributes(const std::string &expansion, std::string &file);
 };
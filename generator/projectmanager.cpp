@@ -21,13 +21,77 @@
 
 #include "projectmanager.h"
 #include "filesystem.h"
+#include "generator.h"
 #include "stringbuilder.h"
 
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
 #include <clang/Basic/Version.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <process.h> // _getpid
+#define getpid _getpid
+#endif
+
+/* Exclusive lock of the lock file of the output directory, taken by the updates of the shared
+ * files which rewrite them, by the appends so that they don't happen during a rewrite, and by
+ * the claims of the pages. */
+struct OutputLock {
+#if CLANG_VERSION_MAJOR >= 13
+    int fd = -1;
+    explicit OutputLock(const std::string &outputPrefix, const char *name = "lock") {
+        if (llvm::sys::fs::openFileForReadWrite(std::string(outputPrefix % "/" % name), fd, llvm::sys::fs::CD_OpenAlways,
+                                                llvm::sys::fs::OF_None)) {
+            fd = -1;
+            return;
+        }
+        llvm::sys::fs::lockFile(fd);
+    }
+    ~OutputLock() {
+        if (fd < 0)
+            return;
+        llvm::sys::fs::unlockFile(fd);
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    }
+#else
+    // Locking files is only supported by llvm since version 13
+    explicit OutputLock(const std::string &, const char * = nullptr) {}
+#endif
+};
+
+// One write, so that the appends of the generators sharing the output directory do not mix
+static void appendToFile(const std::string &path, llvm::StringRef data)
+{
+    std::ofstream file(path, std::ios::app | std::ios::binary);
+    if (!file) {
+        create_directories(llvm::sys::path::parent_path(path));
+        file.open(path, std::ios::app | std::ios::binary);
+    }
+    file.write(data.data(), data.size());
+    file.flush();
+    if (!file)
+        std::cerr << "Error appending to " << path << std::endl;
+}
+
 ProjectManager::ProjectManager(std::string outputPrefix, std::string _dataPath)
         : outputPrefix(std::move(outputPrefix))
         , dataPath(std::move(_dataPath))
@@ -40,6 +104,21 @@ ProjectManager::ProjectManager(std::string outputPrefix, std::string _dataPath)
     }
 }
 
+struct ProjectManager::PendingAppend {
+    std::string data;
+    llvm::raw_string_ostream stream{data};
+};
+
+ProjectManager::~ProjectManager()
+{
+    writeAppends(); // made outside of a translation unit
+    if (journal && !inTranslationUnit) {
+        // Everything was committed
+        journal.reset();
+        llvm::sys::fs::remove(journalPath);
+    }
+}
+
 bool ProjectManager::addProject(ProjectInfo info) {
     if (info.source_path.empty())
         return false;
@@ -51,26 +130,134 @@ bool ProjectManager::addProject(ProjectInfo info) {
         filename += '/';
     info.source_path = filename.c_str();
 
+    if (projectTrie.empty())
+        projectTrie.emplace_back();
+    unsigned int node = 0;
+    llvm::StringRef path = info.source_path;
+    for (auto slash = path.find('/'); slash != llvm::StringRef::npos; slash = path.find('/')) {
+        auto inserted = projectTrie[node].children.insert({path.substr(0, slash), projectTrie.size()});
+        if (inserted.second)
+            projectTrie.emplace_back(); // invalidates 'inserted'
+        node = projectTrie[node].children.lookup(path.substr(0, slash));
+        path = path.substr(slash + 1);
+    }
+    projectTrie[node].project = projects.size(); // the last added project wins
+
     projects.push_back( std::move(info) );
     return true;
 }
 
+bool ProjectManager::addProjectSpec(const std::string &s) {
+    auto colonPos = s.find(':');
+    if (colonPos >= s.size()) {
+        std::cerr << "fail to parse project option : " << s << std::endl;
+        return false;
+    }
+    auto secondColonPos = s.find(':', colonPos+1);
+    ProjectInfo info { s.substr(0, colonPos), s.substr(colonPos+1, secondColonPos - colonPos -1),
+        secondColonPos < s.size() ? s.substr(secondColonPos + 1) : std::string() };
+    if (!addProject(std::move(info))) {
+        std::cerr << "invalid project directory for : " << s << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ProjectManager::addExternalProjectSpec(const std::string &s) {
+    auto colonPos = s.find(':');
+    if (colonPos >= s.size()) {
+        std::cerr << "fail to parse project option : " << s << std::endl;
+        return false;
+    }
+    auto secondColonPos = s.find(':', colonPos+1);
+    if (secondColonPos >= s.size()) {
+        std::cerr << "fail to parse project option : " << s << std::endl;
+        return false;
+    }
+    ProjectInfo info { s.substr(0, colonPos), s.substr(colonPos+1, secondColonPos - colonPos -1),
+        ProjectInfo::External };
+    info.external_root_url = s.substr(secondColonPos + 1);
+    if (!addProject(std::move(info))) {
+        std::cerr << "invalid project directory for : " << s << std::endl;
+        return false;
+    }
+    return true;
+}
+
 ProjectInfo* ProjectManager::projectForFile(llvm::StringRef filename)
 {
-    unsigned int match_length = 0;
-    ProjectInfo *result = nullptr;
+    if (projectTrie.empty())
+        return nullptr;
+    // Only the components followed by a '/' are directories that can be a project's source_path
+    int result = projectTrie[0].project;
+    unsigned int node = 0;
+    for (auto slash = filename.find('/'); slash != llvm::StringRef::npos; slash = filename.find('/')) {
+        auto it = projectTrie[node].children.find(filename.substr(0, slash));
+        if (it == projectTrie[node].children.end())
+            break;
+        node = it->second;
+        if (projectTrie[node].project >= 0)
+            result = projectTrie[node].project;
+        filename = filename.substr(slash + 1);
+    }
+    return result >= 0 ? &projects[result] : nullptr;
+}
 
-    for (auto &it : projects) {
-        const std::string &source_path = it.source_path;
-        if (source_path.size() < match_length) {
-            continue;
-        }
-        if (filename.startswith(source_path)) {
-            result = &it;
-            match_length = source_path.size();
+void ProjectManager::recordInclusion(const llvm::sys::fs::UniqueID &id, llvm::StringRef includedFile,
+                                     llvm::StringRef mainFile)
+{
+    // The same files come back in every translation unit, only canonicalize them once
+    if (!recordedInclusions.insert(id).second)
+        return;
+    llvm::SmallString<256> filename;
+    canonicalize(includedFile, filename);
+    if (filename.empty())
+        return;
+    if (!includersLoaded)
+        loadIncluders();
+    // The first one is kept, by this run and the next ones
+    if (includers.insert({std::string(filename.str()), mainFile.str()}).second)
+        appendStream(outputPrefix + "/includers") << filename << '\t' << mainFile << '\n';
+}
+
+/* The includers file of the output directory has a line '<header>\t<main file>' for each header,
+ * appended by the runs which included it first. The lines appended by the generators which
+ * raced for the same header are removed when there are many of them. */
+void ProjectManager::loadIncluders()
+{
+    includersLoaded = true;
+    std::string includersFile = outputPrefix + "/includers";
+    auto read = [&] {
+        std::ifstream file(includersFile, std::ios::binary);
+        std::string line;
+        unsigned int lines = 0;
+        while (std::getline(file, line)) {
+            llvm::StringRef included, mainFile;
+            std::tie(included, mainFile) = llvm::StringRef(line).split('\t');
+            if (mainFile.empty())
+                continue;
+            lines++;
+            includers.insert({std::string(included), std::string(mainFile)});
         }
+        return lines;
+    };
+    if (read() > 2 * includers.size() + 100) {
+        // Read again under the lock, so that the appends of the others are not lost
+        OutputLock lock(outputPrefix);
+        read();
+        std::string content;
+        for (const auto &it : includers)
+            content += it.first % "\t" % it.second % "\n";
+        write_file_atomically(includersFile, content);
     }
-    return result;
+}
+
+std::string ProjectManager::includerOf(const std::string &filename)
+{
+    if (!includersLoaded)
+        loadIncluders();
+    auto it = includers.find(filename);
+    return it != includers.end() ? it->second : std::string();
 }
 
 bool ProjectManager::shouldProcess(llvm::StringRef filename, ProjectInfo* project)
@@ -80,34 +267,765 @@ bool ProjectManager::shouldProcess(llvm::StringRef filename, ProjectInfo* projec
     if (project->type == ProjectInfo::External)
         return false;
 
-    std::string fn = outputPrefix % "/" % project->name % "/" % filename.substr(project->source_path.size()) % ".html";
-    return !llvm::sys::fs::exists(fn);
-            // || boost::filesystem::last_write_time(p) < entry->getModificationTime();
+    std::string fn = project->name % "/" % filename.substr(project->source_path.size());
+    if (!claimsLoaded)
+        loadClaims();
+    auto it = claims.find(fn);
+    if (it == claims.end()) {
+        readClaims();
+        it = claims.find(fn);
+    }
+    // A page found removed when loading the claims is claimed again
+    std::string staleToken;
+    if (it != claims.end() && !removedPages.empty()) {
+        auto removed = removedPages.find(fn);
+        if (removed != removedPages.end()) {
+            if (removed->second == it->second)
+                staleToken = std::move(removed->second);
+            removedPages.erase(removed);
+        }
+    }
+    if (it == claims.end() || !staleToken.empty()) {
+        // Locked, since the appends are not atomic on every file system (NFS)
+        OutputLock lock(outputPrefix);
+        readClaims(); // someone else might have claimed it just before us
+        it = claims.find(fn);
+        if (it == claims.end() || (!staleToken.empty() && it->second == staleToken)) {
+            std::string records = it == claims.end() ? std::string() : std::string("! " % fn % "\n");
+            records += claimsToken % " " % fn % "\n";
+            appendToFile(outputPrefix + "/claims", records);
+            readClaims();
+            it = claims.find(fn);
+        }
+        if (it == claims.end()) {
+            // The claims file cannot be written, look at the output directory instead
+            return !llvm::sys::fs::exists(std::string(outputPrefix % "/" % fn % ".html"));
+        }
+        if (it->second == claimsToken)
+            writeJournal("P " + fn);
+    }
+    return it->second == claimsToken && !generatedHere.count(fn);
+}
+
+// The pages in the output directory of the projects, as their fn
+static std::vector<std::string> existingPages(const std::vector<ProjectInfo> &projects,
+                                              const std::string &outputPrefix)
+{
+    std::vector<std::string> pages;
+    for (const auto &proj : projects) {
+        if (proj.type == ProjectInfo::External)
+            continue;
+        std::string dir = outputPrefix % "/" % proj.name;
+        std::error_code EC;
+        for (llvm::sys::fs::recursive_directory_iterator it(dir, EC), DirEnd;
+                it != DirEnd && !EC; it.increment(EC)) {
+            llvm::StringRef path = it->path();
+            if (path.endswith(".html"))
+                pages.push_back(std::string(path.drop_back(5).substr(outputPrefix.size() + 1)));
+        }
+    }
+    return pages;
 }
 
-std::string ProjectManager::includeRecovery(llvm::StringRef includeName, llvm::StringRef from)
+/* The claims file is created from the pages already in the output directory (generated by an older
+ * version or before the file was removed). It is written in a temporary file which is then linked
+ * to the claims file, which fails if another process already created it.
+ * The pages of the claims whose generator exited, but which are not in the output directory, were
+ * removed since: they are looked for once here, by listing the output directory, and shouldProcess
+ * claims them again. */
+void ProjectManager::loadClaims()
 {
-#if CLANG_VERSION_MAJOR != 3 || CLANG_VERSION_MINOR >= 5
-    if (includeRecoveryCache.empty()) {
-        for (const auto &proj : projects) {
-            // skip sub project
-            llvm::StringRef sourcePath(proj.source_path);
-            auto parentPath = sourcePath.substr(0, sourcePath.rfind('/'));
-            if (projectForFile(parentPath))
+    claimsLoaded = true;
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    claimsToken = llvm::utohexstr(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count())
+        % "-" % llvm::utohexstr(llvm::sys::Process::GetRandomNumber());
+
+    std::string claimsFile = outputPrefix + "/claims";
+    bool created = false;
+    if (!llvm::sys::fs::exists(claimsFile)) {
+        std::string content;
+        for (const auto &fn : existingPages(projects, outputPrefix))
+            content += "generated " % fn % "\n";
+        created = true;
+        create_directories(outputPrefix);
+        std::string tmp = claimsFile % ".new-" % claimsToken;
+        if (!write_file_atomically(tmp, content)) {
+            llvm::sys::fs::create_hard_link(tmp, claimsFile);
+            llvm::sys::fs::remove(tmp);
+        }
+    }
+    recoverJournals();
+    readClaims();
+    if (created)
+        return;
+
+    std::unordered_map<std::string, bool> alive; // by token
+    llvm::StringSet<> pages;
+    bool pagesListed = false;
+    for (const auto &claim : claims) {
+        if (claim.second == claimsToken)
+            continue;
+        auto a = alive.find(claim.second);
+        if (a == alive.end())
+            a = alive.insert({claim.second, claimerIsAlive(claim.second)}).first;
+        if (a->second)
+            continue;
+        if (!pagesListed) {
+            pagesListed = true;
+            for (const auto &fn : existingPages(projects, outputPrefix))
+                pages.insert(fn);
+        }
+        if (!pages.count(claim.first))
+            removedPages.insert(claim);
+    }
+}
+
+// Reads what was appended to the claims file since the last call, through the same stream
+void ProjectManager::readClaims()
+{
+    if (!claimsStream.is_open()) {
+        claimsStream.open(outputPrefix + "/claims", std::ios::binary);
+        if (!claimsStream)
+            return;
+    }
+    claimsStream.clear();
+    claimsStream.seekg(0, std::ios::end);
+    if (claimsStream.tellg() == std::streampos(claimsOffset))
+        return;
+    claimsStream.seekg(claimsOffset);
+    std::string line;
+    while (std::getline(claimsStream, line)) {
+        if (claimsStream.eof())
+            break; // The last line is not complete yet
+        claimsOffset += line.size() + 1;
+        llvm::StringRef token, fn;
+        std::tie(token, fn) = llvm::StringRef(line).split(' ');
+        if (token.startswith("-")) {
+            // released
+            auto it = claims.find(std::string(fn));
+            if (it != claims.end() && it->second == token.substr(1))
+                claims.erase(it);
+        } else if (token == "!") {
+            // forgotten, whoever claimed it (see forgetOutputs)
+            claims.erase(std::string(fn));
+        } else {
+            claims.insert({std::string(fn), std::string(token)});
+        }
+    }
+}
+
+void ProjectManager::beginTranslationUnit(llvm::StringRef file)
+{
+    inTranslationUnit = true;
+    writeJournal("B " + file.str());
+    // The page of the main file was claimed by shouldProcess before the translation unit began
+    if (auto project = projectForFile(file)) {
+        std::string fn = project->name % "/" % file.substr(project->source_path.size());
+        auto it = claims.find(fn);
+        if (it != claims.end() && it->second == claimsToken && !generatedHere.count(fn))
+            writeJournal("P " + fn);
+    }
+}
+
+void ProjectManager::commitTranslationUnit()
+{
+    if (!inTranslationUnit)
+        return;
+    writeAppends();
+    writeJournal("C");
+    inTranslationUnit = false;
+}
+
+llvm::raw_ostream &ProjectManager::appendStream(const std::string &path)
+{
+    auto &pending = pendingAppends[path];
+    if (!pending)
+        pending.reset(new PendingAppend);
+    return pending->stream;
+}
+
+/* The appends are saved in '<journal>.appends' and the journal gets an 'M' record before the first
+ * one is written, then a 'D <index>' record after each file, so that recoverJournals can complete
+ * them. (A crash between the write of a file and its record writes that file twice.) */
+void ProjectManager::writeAppends()
+{
+    if (pendingAppends.empty())
+        return;
+    std::string saved;
+    for (auto &pending : pendingAppends) {
+        pending.second->stream.flush();
+        saved += pending.first % "\n" % std::to_string(pending.second->data.size()) % "\n";
+        saved += pending.second->data;
+    }
+    std::string savedPath;
+    if (inTranslationUnit && journal) {
+        savedPath = journalPath + ".appends";
+        if (write_file_atomically(savedPath, saved))
+            savedPath.clear();
+        else
+            writeJournal("M");
+    }
+    OutputLock lock(outputPrefix);
+    unsigned index = 0;
+    for (auto &pending : pendingAppends) {
+        appendToFile(pending.first, pending.second->data);
+        if (!savedPath.empty())
+            writeJournal("D " + std::to_string(index));
+        ++index;
+    }
+    pendingAppends.clear();
+    if (!savedPath.empty())
+        llvm::sys::fs::remove(savedPath);
+}
+
+/* The records of the refs files which have a location start with "<tag f='<page>'", only the
+ * <doc> ones can span several lines. The lines of interestingDefinitions start with "<page>|".
+ * The other records are only written once. */
+static std::string withoutRecordsOf(llvm::StringRef content, bool definitions,
+                                    const std::unordered_set<std::string> &pages,
+                                    const std::unordered_set<std::string> &escapedPages)
+{
+    std::string result;
+    llvm::StringSet<> seen;
+    bool inDoc = false;
+    bool skipping = false;
+    while (!content.empty()) {
+        llvm::StringRef line;
+        std::tie(line, content) = content.split('\n');
+        if (inDoc) {
+            inDoc = !line.contains("</doc>");
+        } else if (definitions) {
+            skipping = pages.count(std::string(line.substr(0, line.find('|')))) != 0;
+        } else {
+            size_t file = line.find(" f='");
+            if (line.startswith("<") && file != llvm::StringRef::npos && file == line.find(' ')) {
+                llvm::StringRef name = line.substr(file + 4);
+                name = name.substr(0, name.find('\''));
+                skipping = escapedPages.count(std::string(name)) != 0;
+                inDoc = line.startswith("<doc ") && !line.contains("</doc>");
+            } else {
+                skipping = !seen.insert(line).second;
+            }
+        }
+        if (!skipping)
+            result += line % "\n";
+    }
+    return result;
+}
+
+void ProjectManager::forgetOutputs(const std::vector<std::string> &outputs)
+{
+    checkedFiles.clear(); // the files of the forgotten run might have been removed with it
+    std::unordered_set<std::string> pages, escapedPages;
+    std::vector<std::string> files;
+    for (const auto &output : outputs) {
+        llvm::StringRef path = output;
+        if (!path.startswith(outputPrefix + "/"))
+            continue;
+        llvm::StringRef relative = path.substr(outputPrefix.size() + 1);
+        if (path.endswith(".html") && !path.endswith("/generation_info.html")) {
+            std::string fn = std::string(relative.drop_back(5));
+            llvm::SmallString<64> buffer;
+            escapedPages.insert(std::string(Generator::escapeAttr(fn, buffer)));
+            pages.insert(std::move(fn));
+        } else if (relative.startswith("refs/") || relative.startswith("fnSearch/")
+                   || relative == "interestingDefinitions" || relative == "otherIndex") {
+            files.push_back(output);
+        }
+    }
+    if (pages.empty() && files.empty())
+        return;
+
+    OutputLock lock(outputPrefix);
+    for (const auto &file : files) {
+        auto buffer = llvm::MemoryBuffer::getFile(file);
+        if (!buffer)
+            continue;
+        llvm::StringRef content = (*buffer)->getBuffer();
+        bool definitions = llvm::StringRef(file).endswith("/interestingDefinitions");
+        std::string filtered = withoutRecordsOf(content, definitions, pages, escapedPages);
+        if (filtered != content) {
+            if (auto error_code = write_file_atomically(file, filtered))
+                std::cerr << "Error writing " << file << ": " << error_code.message() << std::endl;
+        }
+    }
+    std::string releases;
+    for (const auto &fn : pages) {
+        llvm::sys::fs::remove(std::string(outputPrefix % "/" % fn % ".html"));
+        releases += "! " % fn % "\n";
+        generatedHere.erase(fn);
+    }
+    if (llvm::sys::fs::exists(outputPrefix + "/claims")) {
+        std::ofstream claimsFile(outputPrefix + "/claims", std::ios::app | std::ios::binary);
+        claimsFile << releases << std::flush;
+    }
+    if (claimsLoaded)
+        readClaims(); // the service forgets the pages it generated itself
+}
+
+void ProjectManager::journalWrite(const std::string &path)
+{
+    if (inTranslationUnit)
+        writeJournal("W " % std::to_string(getpid()) % " " % path);
+}
+
+bool ProjectManager::needsWrite(const std::string &path)
+{
+    if (!checkedFiles.insert(path).second)
+        return false;
+    return !llvm::sys::fs::exists(path);
+}
+
+#if CLANG_VERSION_MAJOR >= 13
+void ProjectManager::writeJournal(const std::string &record)
+{
+    if (journalFailed)
+        return;
+    if (!claimsLoaded)
+        loadClaims();
+    if (!journal) {
+        std::string dir = outputPrefix + "/journal";
+        create_directories(dir);
+        journalPath = dir % "/" % claimsToken;
+        int fd;
+        if (auto error_code = llvm::sys::fs::openFileForReadWrite(journalPath, fd, llvm::sys::fs::CD_CreateAlways,
+                                                                  llvm::sys::fs::OF_Append)) {
+            std::cerr << "Error creating the journal " << journalPath << ": " << error_code.message() << std::endl;
+            journalFailed = true;
+            return;
+        }
+        // Kept locked until the process exits, to tell the other generators that it is alive
+        llvm::sys::fs::tryLockFile(fd);
+        journal.reset(new llvm::raw_fd_ostream(fd, true));
+        journal->SetUnbuffered();
+    }
+    *journal << record << '\n';
+}
+
+void ProjectManager::recoverJournals()
+{
+    std::vector<std::string> journals;
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator it(outputPrefix + "/journal", EC), DirEnd;
+            it != DirEnd && !EC; it.increment(EC)) {
+        if (!llvm::StringRef(it->path()).endswith(".appends"))
+            journals.push_back(it->path());
+    }
+    for (const auto &path : journals) {
+        int fd;
+        if (llvm::sys::fs::openFileForReadWrite(path, fd, llvm::sys::fs::CD_OpenExisting, llvm::sys::fs::OF_None))
+            continue;
+        if (!llvm::sys::fs::tryLockFile(fd)) {
+            // Its generator is gone. (Another one might just have rolled it back.)
+            if (llvm::sys::fs::exists(path)) {
+                std::cerr << "Rolling back the interrupted generation of " << path << std::endl;
+                rollbackJournal(path, std::string(llvm::sys::path::filename(path)));
+                llvm::sys::fs::remove(path);
+            }
+        }
+        llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    }
+}
+
+/* A translation unit which was not committed is undone by removing its pages, since its appends
+ * were not written yet. The appends of a translation unit which was being committed are completed
+ * from the saved copy. */
+void ProjectManager::rollbackJournal(const std::string &path, const std::string &token)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer)
+        return;
+    std::vector<std::string> claimed;
+    std::vector<std::string> pages; // claimed in the unfinished translation unit
+    std::vector<std::string> temporaries; // of the files being written atomically
+    std::set<unsigned> appended; // the files of the saved appends which were written
+    bool inUnit = false;
+    bool committing = false;
+    llvm::StringRef content = (*buffer)->getBuffer();
+    while (!content.empty()) {
+        llvm::StringRef line;
+        std::tie(line, content) = content.split('\n');
+        if (content.empty() && !(*buffer)->getBuffer().endswith("\n"))
+            break; // the last record was not completely written
+        if (line.startswith("B ")) {
+            inUnit = true;
+            committing = false;
+            pages.clear();
+            temporaries.clear();
+            appended.clear();
+        } else if (line == "C") {
+            inUnit = false;
+            committing = false;
+        } else if (line == "M") {
+            committing = inUnit;
+        } else if (line.startswith("D ")) {
+            unsigned index;
+            if (!line.substr(2).getAsInteger(10, index))
+                appended.insert(index);
+        } else if (line.startswith("P ")) {
+            claimed.push_back(std::string(line.substr(2)));
+            if (inUnit)
+                pages.push_back(claimed.back());
+        } else if (line.startswith("W ") && inUnit) {
+            // The file itself is complete if it exists, and might be used by other pages
+            llvm::StringRef pid, file;
+            std::tie(pid, file) = line.substr(2).split(' ');
+            temporaries.push_back(file % ".tmp" % pid);
+        }
+    }
+
+    for (const auto &tmp : temporaries)
+        llvm::sys::fs::remove(tmp);
+    checkedFiles.clear(); // look again if the files exist
+
+    std::string savedPath = path + ".appends";
+    if (committing) {
+        // The translation unit was complete, only some of its appends are missing
+        auto saved = llvm::MemoryBuffer::getFile(savedPath);
+        llvm::StringRef data = saved ? (*saved)->getBuffer() : llvm::StringRef();
+        for (unsigned index = 0; !data.empty(); ++index) {
+            llvm::StringRef file, size;
+            std::tie(file, data) = data.split('\n');
+            std::tie(size, data) = data.split('\n');
+            size_t s;
+            if (size.getAsInteger(10, s) || s > data.size())
+                break;
+            if (!appended.count(index))
+                appendToFile(std::string(file), data.substr(0, s));
+            data = data.substr(s);
+        }
+    } else if (inUnit) {
+        for (const auto &fn : pages)
+            llvm::sys::fs::remove(std::string(outputPrefix % "/" % fn % ".html"));
+    }
+    llvm::sys::fs::remove(savedPath);
+
+    // Release the pages which were claimed but not generated
+    std::string releases;
+    for (const auto &fn : claimed) {
+        if (!llvm::sys::fs::exists(std::string(outputPrefix % "/" % fn % ".html")))
+            releases += "-" % token % " " % fn % "\n";
+    }
+    if (!releases.empty()) {
+        OutputLock lock(outputPrefix);
+        std::ofstream claimsFile(outputPrefix + "/claims", std::ios::app | std::ios::binary);
+        claimsFile << releases << std::flush;
+    }
+}
+
+// The generators keep their journal locked until they exit
+bool ProjectManager::claimerIsAlive(const std::string &token)
+{
+    if (token == "generated")
+        return false;
+    int fd;
+    if (llvm::sys::fs::openFileForReadWrite(std::string(outputPrefix % "/journal/" % token), fd,
+                                            llvm::sys::fs::CD_OpenExisting, llvm::sys::fs::OF_None))
+        return false;
+    bool alive = bool(llvm::sys::fs::tryLockFile(fd));
+    if (!alive)
+        llvm::sys::fs::unlockFile(fd);
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+    return alive;
+}
+#else
+// The journal needs to lock files, which llvm only supports since version 13
+void ProjectManager::writeJournal(const std::string &) {}
+void ProjectManager::recoverJournals() {}
+void ProjectManager::rollbackJournal(const std::string &, const std::string &) {}
+bool ProjectManager::claimerIsAlive(const std::string &token) { return token != "generated"; }
+#endif
+
+namespace {
+// The content of one directory, as stored in the include recovery index
+struct IndexedDirectory {
+    unsigned long long mtime = 0;
+    std::vector<std::string> files;
+    std::vector<std::string> subdirs;
+};
+
+const char includeRecoveryIndexHeader[] = "codebrowser include recovery index 2";
+
+unsigned long long modificationTime(const llvm::sys::fs::file_status &status) {
+#if CLANG_VERSION_MAJOR >= 5
+    return status.getLastModificationTime().time_since_epoch().count();
+#else
+    return status.getLastModificationTime().toEpochTime();
+#endif
+}
+
+std::string childPath(const std::string &dir, const std::string &name) {
+    if (!dir.empty() && dir.back() == '/')
+        return dir + name;
+    return dir % "/" % name;
+}
+
+bool readIncludeRecoveryIndex(const std::string &indexFile, std::map<std::string, IndexedDirectory> &index) {
+    auto buffer = llvm::MemoryBuffer::getFile(indexFile);
+    if (!buffer)
+        return false;
+    llvm::StringRef content = (*buffer)->getBuffer();
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+    if (line != includeRecoveryIndexHeader)
+        return false;
+    IndexedDirectory *current = nullptr;
+    while (!content.empty()) {
+        std::tie(line, content) = content.split('\n');
+        if (line.size() < 2)
+            continue;
+        llvm::StringRef value = line.substr(2);
+        switch (line[0]) {
+        case 'D': {
+            llvm::StringRef mtime, path;
+            std::tie(mtime, path) = value.split(' ');
+            current = &index[std::string(path)];
+            mtime.getAsInteger(10, current->mtime);
+            break;
+        }
+        case 'f':
+            if (current)
+                current->files.push_back(std::string(value));
+            break;
+        case 'd':
+            if (current)
+                current->subdirs.push_back(std::string(value));
+            break;
+        }
+    }
+    return true;
+}
+
+void writeIncludeRecoveryIndex(const std::string &indexFile, const std::map<std::string, IndexedDirectory> &index) {
+    std::string content;
+    llvm::raw_string_ostream out(content);
+    out << includeRecoveryIndexHeader << '\n';
+    for (const auto &dir : index) {
+        out << "D " << dir.second.mtime << ' ' << dir.first << '\n';
+        for (const auto &f : dir.second.files)
+            out << "f " << f << '\n';
+        for (const auto &d : dir.second.subdirs)
+            out << "d " << d << '\n';
+    }
+    out.flush();
+    if (write_file_atomically(indexFile, content))
+        std::cerr << "Error: could not write " << indexFile << std::endl;
+}
+
+bool listDirectory(const std::string &dir, const llvm::sys::fs::file_status &status, IndexedDirectory &result) {
+    result.mtime = modificationTime(status);
+    result.files.clear();
+    result.subdirs.clear();
+    std::error_code EC;
+    for (llvm::sys::fs::directory_iterator it(dir, EC), DirEnd;
+            it != DirEnd && !EC; it.increment(EC)) {
+        auto fileName = llvm::sys::path::filename(it->path());
+        if (fileName.startswith("."))
+            continue;
+        if (llvm::sys::fs::is_directory(it->path()))
+            result.subdirs.push_back(std::string(fileName));
+        else
+            result.files.push_back(std::string(fileName));
+    }
+    return !EC;
+}
+
+/* Adds to the index the directories of the queue and their subdirectories, in parallel, skipping
+ * those already in the index. The symlinks to directories are followed, but each directory is
+ * only walked once, so that the loops end. */
+void walkDirectories(std::deque<std::string> queue, std::map<std::string, IndexedDirectory> &index,
+                     unsigned int threadCount) {
+    std::set<llvm::sys::fs::UniqueID> visited;
+    std::mutex mutex;
+    std::condition_variable condition;
+    unsigned int busy = 0;
+    auto worker = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [&] { return !queue.empty() || busy == 0; });
+            if (queue.empty())
+                return;
+            std::string dir = std::move(queue.front());
+            queue.pop_front();
+            if (index.count(dir))
                 continue;
+            busy++;
+            lock.unlock();
+
+            llvm::sys::fs::file_status status;
+            bool exists = !llvm::sys::fs::status(dir, status) && llvm::sys::fs::is_directory(status);
+            llvm::SmallString<256> target;
+#if CLANG_VERSION_MAJOR >= 5
+            if (exists && llvm::sys::fs::is_symlink_file(dir) && !llvm::sys::fs::real_path(dir, target)) {
+                lock.lock();
+                exists = !index.count(std::string(target.str())); // already walked from its real path
+                lock.unlock();
+            }
+#endif
+            IndexedDirectory result;
+            lock.lock();
+            exists = exists && visited.insert(status.getUniqueID()).second;
+            lock.unlock();
+            if (exists)
+                listDirectory(dir, status, result);
+
+            lock.lock();
+            busy--;
+            if (exists) {
+                for (const auto &sub : result.subdirs)
+                    queue.push_back(childPath(dir, sub));
+                index[dir] = std::move(result);
+            }
+            condition.notify_all();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+}
+}
 
-            std::error_code EC;
-            for (llvm::sys::fs::recursive_directory_iterator it(sourcePath, EC), DirEnd;
-                    it != DirEnd && !EC; it.increment(EC)) {
-                auto fileName = llvm::sys::path::filename(it->path());
-                if (fileName.startswith(".")) {
-                    it.no_push();
+struct ProjectManager::IncludeRecoveryIndex {
+    std::map<std::string, IndexedDirectory> dirs;
+    std::unordered_set<std::string> restated; // the directories looked at again by this process
+};
+
+/* The files of all the projects are indexed by name in the includeRecovery file of the output
+ * directory. The directories are walked once per output directory, by the first generator which
+ * needs the index, while the others wait for it. Then the index is trusted, and a directory is only
+ * looked at again when a lookup in it misses (see refreshIncludeRecovery). Remove the file to walk
+ * the projects again. */
+void ProjectManager::loadIncludeRecoveryCache()
+{
+    includeRecoveryLoaded = true;
+    includeRecoveryIndex.reset(new IncludeRecoveryIndex);
+    auto &dirs = includeRecoveryIndex->dirs;
+    std::string indexFile = outputPrefix % "/includeRecovery";
+    if (!readIncludeRecoveryIndex(indexFile, dirs)) {
+        OutputLock lock(outputPrefix, "includeRecovery.lock");
+        dirs.clear();
+        if (!readIncludeRecoveryIndex(indexFile, dirs)) {
+            dirs.clear();
+            std::deque<std::string> queue;
+            for (const auto &proj : projects) {
+                // skip sub project
+                llvm::StringRef sourcePath(proj.source_path);
+                auto parentPath = sourcePath.substr(0, sourcePath.rfind('/'));
+                if (projectForFile(parentPath))
                     continue;
+                queue.push_back(parentPath.empty() ? std::string("/") : std::string(parentPath));
+            }
+            // Waiting for the file system, more threads do not help
+            const unsigned int maxThreads = 8;
+            walkDirectories(std::move(queue), dirs, std::min(std::thread::hardware_concurrency(), maxThreads));
+            writeIncludeRecoveryIndex(indexFile, dirs);
+        }
+    }
+
+    for (const auto &dir : dirs) {
+        for (const auto &f : dir.second.files)
+            includeRecoveryCache.insert({f, childPath(dir.first, f)});
+        for (const auto &d : dir.second.subdirs)
+            includeRecoveryCache.insert({d, childPath(dir.first, d)});
+    }
+}
+
+/* When the include was not found, or was found at a path which is gone, the directories of the
+ * index in which it could be are looked at again, once per process: the directory of the including
+ * file and its parents, the directories named like the directory of the include, and the directory
+ * of the file which is gone. Those which changed are listed again, with their new subdirectories.
+ * Returns whether the index changed. */
+bool ProjectManager::refreshIncludeRecovery(llvm::StringRef includeName, llvm::StringRef from,
+                                            llvm::StringRef gone)
+{
+    auto &dirs = includeRecoveryIndex->dirs;
+    std::vector<std::string> candidates;
+    for (llvm::StringRef dir = llvm::sys::path::parent_path(from); !dir.empty();
+            dir = llvm::sys::path::parent_path(dir)) {
+        if (!dirs.count(std::string(dir)))
+            break;
+        candidates.push_back(std::string(dir));
+    }
+    llvm::StringRef includeDir = llvm::sys::path::parent_path(includeName);
+    if (!includeDir.empty()) {
+        std::string suffix = std::string("/" % includeDir);
+        for (const auto &dir : dirs) {
+            if (llvm::StringRef(dir.first).endswith(suffix))
+                candidates.push_back(dir.first);
+        }
+    }
+    if (!gone.empty())
+        candidates.push_back(std::string(llvm::sys::path::parent_path(gone)));
+
+    bool changed = false;
+    for (const auto &dir : candidates) {
+        auto it = dirs.find(dir);
+        if (it == dirs.end() || !includeRecoveryIndex->restated.insert(dir).second)
+            continue;
+        llvm::sys::fs::file_status status;
+        bool exists = !llvm::sys::fs::status(dir, status) && llvm::sys::fs::is_directory(status);
+        if (exists && modificationTime(status) == it->second.mtime)
+            continue;
+        changed = true;
+        // Forget the directory and its subdirectories, then walk it again
+        std::string prefix = childPath(dir, std::string());
+        auto end = dirs.upper_bound(prefix + "\xff");
+        for (auto sub = it; sub != end; ) {
+            if (sub != it && !llvm::StringRef(sub->first).startswith(prefix)) {
+                ++sub;
+                continue;
+            }
+            for (const auto *names : { &sub->second.files, &sub->second.subdirs }) {
+                for (const auto &name : *names) {
+                    auto range = includeRecoveryCache.equal_range(name);
+                    std::string path = childPath(sub->first, name);
+                    for (auto c = range.first; c != range.second; ) {
+                        if (c->second == path)
+                            c = includeRecoveryCache.erase(c);
+                        else
+                            ++c;
+                    }
                 }
-                includeRecoveryCache.insert({std::string(fileName), it->path()});
             }
+            sub = dirs.erase(sub);
+        }
+        if (!exists)
+            continue;
+        std::map<std::string, IndexedDirectory> walked;
+        walkDirectories({ dir }, walked, 1);
+        for (auto &w : walked) {
+            for (const auto &f : w.second.files)
+                includeRecoveryCache.insert({f, childPath(w.first, f)});
+            for (const auto &d : w.second.subdirs)
+                includeRecoveryCache.insert({d, childPath(w.first, d)});
+            dirs[w.first] = std::move(w.second);
         }
     }
+    if (changed)
+        writeIncludeRecoveryIndex(outputPrefix % "/includeRecovery", dirs);
+    return changed;
+}
+
+std::string ProjectManager::includeRecovery(llvm::StringRef includeName, llvm::StringRef from)
+{
+#if CLANG_VERSION_MAJOR != 3 || CLANG_VERSION_MINOR >= 5
+    if (!includeRecoveryLoaded)
+        loadIncludeRecoveryCache();
+    std::string resolved = lookupIncludeRecovery(includeName, from);
+    if ((resolved.empty() || !llvm::sys::fs::exists(resolved))
+            && refreshIncludeRecovery(includeName, from, resolved))
+        resolved = lookupIncludeRecovery(includeName, from);
+    return resolved;
+#else
+    return {}; // Not supported with clang < 3.4
+#endif
+}
+
+std::string ProjectManager::lookupIncludeRecovery(llvm::StringRef includeName, llvm::StringRef from)
+{
     llvm::StringRef includeFileName = llvm::sys::path::filename(includeName);
     std::string resolved;
     int weight = -1000;
@@ -144,7 +1062,4 @@ std::string ProjectManager::includeRecovery(llvm::StringRef includeName, llvm::S
         resolved = std::string(candidate);
     }
     return resolved;
-#else
-    return {}; // Not supported with clang < 3.4
-#endif
 }
@@ -21,10 +21,22 @@
 
 #pragma once
 
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+
+namespace llvm {
+class raw_fd_ostream;
+class raw_ostream;
+}
 
 struct ProjectInfo {
     std::string name;
@@ -52,8 +64,13 @@ struct ProjectInfo {
 
 struct ProjectManager {
     explicit ProjectManager(std::string outputPrefix, std::string _dataPath);
+    ~ProjectManager();
 
     bool addProject(ProjectInfo info);
+    // Parse and add a project given on the command line as <name>:<path>[:<revision>]
+    bool addProjectSpec(const std::string &spec);
+    // Parse and add an external project given as <name>:<path>:<url>
+    bool addExternalProjectSpec(const std::string &spec);
 
     std::vector<ProjectInfo> projects;
 
@@ -65,12 +82,108 @@ struct ProjectManager {
 
     // return true if the filename should be proesseded.
     // 'project' is the value returned by projectForFile
+    // The first call for a file claims it for this process, so that no other generator sharing
+    // the output directory generates it too.
     bool shouldProcess(llvm::StringRef filename, ProjectInfo *project);
 
+    // To be called when the page for 'fn' (project name / path) was written, so that the other
+    // translation units of this process do not generate it again.
+    void markGenerated(const std::string &fn) { generatedHere.insert(fn); }
+
     std::string includeRecovery(llvm::StringRef includeName, llvm::StringRef from);
 
+    /* The main file of the first translation unit of the compilation database which included a
+     * file, so a file which is not in the database can borrow the command of a translation unit
+     * which really includes it. 'id' is the unique ID of the included file, 'includedFile' its
+     * name as given to the preprocessor. The inclusions are also appended to the includers file
+     * of the output directory, for the other generators and the next runs. */
+    void recordInclusion(const llvm::sys::fs::UniqueID &id, llvm::StringRef includedFile,
+                         llvm::StringRef mainFile);
+    // Returns the main file recorded for the canonicalized 'filename', or an empty string
+    std::string includerOf(const std::string &filename);
+
+    /* Journal of the generation, so that a run interrupted by a crash can be resumed.
+     * The pages are recorded with their claims. The appends to the files shared with the other
+     * generators are kept in memory until the translation unit is committed, then saved next to
+     * the journal before they are written to the files, one record per file done. When a generator
+     * finds the journal of a generator which died (the journals are locked as long as their
+     * generator runs), it completes the appends of a translation unit that was being committed,
+     * or else removes the pages of the translation unit that was not committed and the temporary
+     * files of its atomic writes. Then it releases the claims of the pages that were not generated.
+     * The appends of the other generators are never touched. */
+    void beginTranslationUnit(llvm::StringRef file);
+    void commitTranslationUnit();
+    // The stream to append to the file 'path' of the output directory, until the commit
+    llvm::raw_ostream &appendStream(const std::string &path);
+
+    /* Undoes a previous run, given the list of its outputs (see --outputs-list), so that the same
+     * translation units can be generated again: its pages are removed and their claims dropped,
+     * the refs and definitions located in these pages are removed, and the duplicates of the
+     * other records it appended (members, sizes, function search) are ignored. */
+    void forgetOutputs(const std::vector<std::string> &outputs);
+    // To be called before creating a file with write_file_atomically
+    void journalWrite(const std::string &path);
+    /* Returns true if the file 'path' of the output directory, named after its content (the macro
+     * expansions), still has to be written. Only the first call for a path looks at the output
+     * directory, until a rollback or forgetOutputs may have removed some files. */
+    bool needsWrite(const std::string &path);
+
 private:
     static std::vector<ProjectInfo> systemProjects();
 
+    // Trie of the path components of the projects' source_path, for the longest prefix lookup
+    // in projectForFile. 'project' is the index in 'projects' of the project ending at that node.
+    struct PathNode {
+        llvm::StringMap<unsigned int> children;
+        int project = -1;
+    };
+    std::vector<PathNode> projectTrie;
+
     std::unordered_multimap<std::string, std::string> includeRecoveryCache;
+
+    std::unordered_map<std::string, std::string> includers; // canonical path -> main file
+    std::set<llvm::sys::fs::UniqueID> recordedInclusions;   // the files already canonicalized
+    bool includersLoaded = false;
+    void loadIncluders();
+
+    /* Registry of the pages generated or being generated, so shouldProcess does not need to look
+     * at the output directory. It is shared with the other generators through the claims file in
+     * the output directory, where each process appends a line '<token> <fn>' when it claims a
+     * page. The first claim for a page in that file wins. */
+    std::string claimsToken;                              // unique for this process
+    std::unordered_map<std::string, std::string> claims;  // fn -> token of the owner
+    std::unordered_set<std::string> generatedHere;
+    std::unordered_set<std::string> checkedFiles;         // by needsWrite
+    std::ifstream claimsStream;                           // opened once, read incrementally
+    unsigned long long claimsOffset = 0;                  // what was already read from the file
+    std::unordered_map<std::string, std::string> removedPages; // fn -> token of the stale claim
+    bool claimsLoaded = false;
+    void loadClaims();
+    void readClaims();
+    bool claimerIsAlive(const std::string &token);
+    struct IncludeRecoveryIndex;
+    std::unique_ptr<IncludeRecoveryIndex> includeRecoveryIndex;
+    bool includeRecoveryLoaded = false;
+    void loadIncludeRecoveryCache();
+    bool refreshIncludeRecovery(llvm::StringRef includeName, llvm::StringRef from, llvm::StringRef gone);
+    std::string lookupIncludeRecovery(llvm::StringRef includeName, llvm::StringRef from);
+
+    std::unique_ptr<llvm::raw_fd_ostream> journal;
+    std::string journalPath;
+    bool journalFailed = false;
+    bool inTranslationUnit = false;
+    struct PendingAppend;
+    std::map<std::string, std::unique_ptr<PendingAppend>> pendingAppends; // by file
+    void writeAppends();
+    void writeJournal(const std::string &record);
+    void recoverJournals();
+    void rollbackJournal(const std::string &path, const std::string &token);
+};
+
+// Begins a translation unit in the journal, and commits it when it goes out of scope
+struct JournalTransaction {
+    ProjectManager &projectManager;
+    JournalTransaction(ProjectManager &projectManager, llvm::StringRef file) : projectManager(projectManager)
+    { projectManager.beginTranslationUnit(file); }
+    ~JournalTransaction() { projectManager.commitTranslationUnit(); }
 };
@@ -31,12 +31,29 @@
 #include <clang/Basic/Version.h>
 #include <llvm/Support/MemoryBuffer.h>
 
+const QtMethodIndex::ClassMethods &QtMethodIndex::methodsOf(const clang::CXXRecordDecl* record)
+{
+    auto it = classes.find(record);
+    if (it != classes.end())
+        return it->second;
+
+    ClassMethods &methods = classes[record];
+    for (auto mi = record->method_begin(); mi != record->method_end(); ++mi) {
+        if (!(*mi)->getIdentifier())
+            continue;
+        methods.byName[(*mi)->getName()].push_back(*mi);
+        if (!methods.d_func && (*mi)->getName() == "d_func" && !getResultType(*mi).isNull())
+            methods.d_func = *mi;
+    }
+    return methods;
+}
+
 /**
  * Lookup candidates function of name \a methodName within the QObject derivative \a objClass
  * its bases, or its private implementation
  */
-static llvm::SmallVector<clang::CXXMethodDecl *, 10> lookUpCandidates(const clang::CXXRecordDecl* objClass,
-                                                                      llvm::StringRef methodName)
+llvm::SmallVector<clang::CXXMethodDecl *, 10> QtSupport::lookUpCandidates(const clang::CXXRecordDecl* objClass,
+                                                                          llvm::StringRef methodName)
 {
     llvm::SmallVector<clang::CXXMethodDecl *, 10> candidates;
     clang::CXXMethodDecl *d_func = nullptr;
@@ -45,14 +62,12 @@ static llvm::SmallVector<clang::CXXMethodDecl *, 10> lookUpCandidates(const clan
         if (!classIt->getDefinition())
             break;
 
-        for (auto mi = classIt->method_begin(); mi != classIt->method_end(); ++mi) {
-            if (!(*mi)->getIdentifier())
-                continue;
-            if ((*mi)->getName() == methodName)
-                candidates.push_back(*mi);
-            if (!d_func && (*mi)->getName() == "d_func" && !getResultType(*mi).isNull())
-                d_func = *mi;
-        }
+        const auto &methods = methodIndex.methodsOf(classIt);
+        auto named = methods.byName.find(methodName);
+        if (named != methods.byName.end())
+            candidates.append(named->second.begin(), named->second.end());
+        if (!d_func)
+            d_func = methods.d_func;
 
         // Look in the first base  (because the QObject need to be the first base class)
         classIt = classIt->getNumBases() == 0 ? nullptr :
@@ -21,14 +21,34 @@
 
 #pragma once
 
+#include <unordered_map>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+
 namespace clang {
 class CallExpr;
 class NamedDecl;
 class Expr;
 class CXXConstructExpr;
+class CXXMethodDecl;
+class CXXRecordDecl;
 }
 class Annotator;
 
+/**
+ * The methods of the classes used in a connect, indexed by name the first time the class is seen.
+ * Owned by the visitor so it is shared by all the calls of a translation unit.
+ */
+struct QtMethodIndex {
+    struct ClassMethods {
+        llvm::StringMap<llvm::SmallVector<clang::CXXMethodDecl *, 2>> byName;
+        clang::CXXMethodDecl *d_func = nullptr;
+    };
+    const ClassMethods &methodsOf(const clang::CXXRecordDecl *record);
+private:
+    std::unordered_map<const clang::CXXRecordDecl *, ClassMethods> classes;
+};
+
 
 /**
  * Handle the SIGNAL and SLOT macro within calls to QObject::connect or the like
@@ -38,11 +58,14 @@ class Annotator;
 struct QtSupport {
     Annotator &annotator;
     clang::NamedDecl *currentContext;
+    QtMethodIndex &methodIndex;
 
     void visitCallExpr(clang::CallExpr *e);
     void visitCXXConstructExpr(clang::CXXConstructExpr* e);
 
 private:
+    llvm::SmallVector<clang::CXXMethodDecl *, 10> lookUpCandidates(const clang::CXXRecordDecl* objClass,
+                                                                   llvm::StringRef methodName);
     void handleSignalOrSlot(clang::Expr *obj, clang::Expr *method);
     void handleInvokeMethod(clang::Expr *obj, clang::Expr *method);
 };
@@ -27,17 +27,135 @@
 #include <vector>
 #include <map>
 #include <ctime>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <direct.h>
+#endif
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/SHA1.h>
 
 #include "../global.h"
+#include "../generator/filesystem.h"
 
 const char *data_url = "../data";
 
 std::map<std::string, std::string, std::greater<std::string> > project_map;
 
-struct FolderInfo {
-//    std::string name;
-    std::map<std::string, std::shared_ptr<FolderInfo>> subfolders;
+// All the files and folders listed in the fileIndex.
+// The nodes are stored in a single vector and their names point into the content of the
+// fileIndex, so that the tree does not need allocations for each of the millions of files.
+struct FolderTree {
+    static const uint32_t None = uint32_t(-1);
+    struct Node {
+        size_t nameOffset = 0;
+        uint32_t nameLength = 0;
+        uint32_t firstChild = None;
+        uint32_t nextSibling = None;
+        bool isFolder = false;
+    };
+    std::string data;
+    std::vector<Node> nodes;
+    std::vector<std::pair<size_t, size_t>> lines; // offset and length of the sorted, unique, paths
+
+    std::string name(uint32_t node) const {
+        return data.substr(nodes[node].nameOffset, nodes[node].nameLength);
+    }
+
+    // Sort order of the paths. '/' sorts before any other character so the entries of
+    // a folder come together and in the order of their names.
+    struct PathLess {
+        const std::string &data;
+        bool operator()(const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b) const {
+            size_t len = std::min(a.second, b.second);
+            for (size_t i = 0; i < len; ++i) {
+                unsigned char ca = data[a.first + i];
+                unsigned char cb = data[b.first + i];
+                if (ca != cb)
+                    return (ca == '/' ? 0 : ca) < (cb == '/' ? 0 : cb);
+            }
+            return a.second < b.second;
+        }
+    };
+
+    void build(std::string content) {
+        data = std::move(content);
+        lines.clear();
+        size_t pos = 0;
+        while (pos < data.size()) {
+            size_t end = data.find('\n', pos);
+            if (end == std::string::npos)
+                end = data.size();
+            if (end > pos)
+                lines.emplace_back(pos, end - pos);
+            pos = end + 1;
+        }
+        std::sort(lines.begin(), lines.end(), PathLess{data});
+        lines.erase(std::unique(lines.begin(), lines.end(), [this](const std::pair<size_t, size_t> &a,
+                                                                   const std::pair<size_t, size_t> &b) {
+            return a.second == b.second && data.compare(a.first, a.second, data, b.first, b.second) == 0;
+        }), lines.end());
+
+        nodes.clear();
+        nodes.emplace_back();
+        nodes[0].isFolder = true;
+        // Since the lines are sorted, only the folders of the previous line can get new children.
+        std::vector<uint32_t> stack = { 0 };
+        std::vector<uint32_t> lastChild = { None };
+        for (const auto &line : lines) {
+            size_t depth = 1;
+            size_t begin = line.first;
+            size_t end = line.first + line.second;
+            while (begin < end) {
+                size_t sep = data.find('/', begin);
+                if (sep > end)
+                    sep = end;
+                if (sep == begin) { // ignore empty components
+                    begin++;
+                    continue;
+                }
+                size_t len = sep - begin;
+                if (depth < stack.size() && nodes[stack[depth]].nameLength == len
+                        && data.compare(nodes[stack[depth]].nameOffset, len, data, begin, len) == 0) {
+                    // already known
+                } else {
+                    stack.resize(depth);
+                    lastChild.resize(depth);
+                    uint32_t n = nodes.size();
+                    nodes.emplace_back();
+                    nodes[n].nameOffset = begin;
+                    nodes[n].nameLength = len;
+                    uint32_t parent = stack[depth - 1];
+                    if (lastChild[depth - 1] == None)
+                        nodes[parent].firstChild = n;
+                    else
+                        nodes[lastChild[depth - 1]].nextSibling = n;
+                    lastChild[depth - 1] = n;
+                    stack.push_back(n);
+                    lastChild.push_back(None);
+                }
+                if (sep < end)
+                    nodes[stack[depth]].isFolder = true;
+                depth++;
+                begin = sep + 1;
+            }
+        }
+    }
 };
+const uint32_t FolderTree::None;
 
 std::string extractMetaFromHTML(std::string metaName, std::string fullPath) {
     std::ifstream filein(fullPath, std::ifstream::in);
@@ -51,6 +169,61 @@ std::string extractMetaFromHTML(std::string metaName, std::string fullPath) {
     return "";
 }
 
+static bool writeIfChanged(const std::string &filename, const std::string &content) {
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (in) {
+            std::ostringstream current;
+            current << in.rdbuf();
+            if (current.str() == content)
+                return true;
+        }
+    }
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        out << content;
+        if (!out) {
+            std::cerr << "Error writing " << tmp << std::endl;
+            return false;
+        }
+    }
+    std::remove(filename.c_str());
+    return std::rename(tmp.c_str(), filename.c_str()) == 0;
+}
+
+// file path -> comma separated interesting definitions, as written by the generator in
+// the interestingDefinitions file. Older generators did not write it, in that case the
+// definitions are read from the meta tag of each page.
+std::map<std::string, std::string> interestingDefinitionsIndex;
+bool hasInterestingDefinitionsIndex = false;
+
+/* The generators append a line each time they generate a page, so the last line of a file is the
+ * current one. The file is then written back with only those lines. */
+void loadInterestingDefinitions(const std::string &root) {
+    std::string file = root + "/interestingDefinitions";
+    std::ifstream filein(file);
+    if (!filein)
+        return;
+    hasInterestingDefinitionsIndex = true;
+    size_t lines = 0;
+    for (std::string line; std::getline(filein, line); ) {
+        auto sep = line.rfind('|');
+        if (sep == std::string::npos)
+            continue;
+        lines++;
+        interestingDefinitionsIndex[line.substr(0, sep)] = line.substr(sep + 1);
+    }
+    filein.close();
+    if (lines == interestingDefinitionsIndex.size())
+        return;
+    std::string content;
+    for (const auto &it : interestingDefinitionsIndex)
+        content += it.first + '|' + it.second + '\n';
+    if (!writeIfChanged(file, content))
+        std::cerr << "Error compacting " << file << std::endl;
+}
+
 std::string cutNameSpace(std::string &className) {
     int colonPos = className.find_last_of("::");
     if (colonPos != std::string::npos)
@@ -59,7 +232,7 @@ std::string cutNameSpace(std::string &className) {
         return className;
 }
 
-void linkInterestingDefinitions(std::ofstream &myfile, std::string linkFile, std::string &interestingDefitions)
+void linkInterestingDefinitions(std::ostream &myfile, std::string linkFile, std::string &interestingDefitions)
 {
     if (interestingDefitions.length() == 0) {
         return;
@@ -82,16 +255,68 @@ void linkInterestingDefinitions(std::ofstream &myfile, std::string linkFile, std
 
 }
 
-void gererateRecursisively(FolderInfo *folder, const std::string &root, const std::string &path, const std::string &rel = "") {
-    std::ofstream myfile;
-    std::string filename = root + "/" + path + "index.html";
-    myfile.open(filename);
-    if (!myfile) {
-        std::cerr << "Error generating " << filename << std::endl;
-        return;
+// SHA-1 in lower case hex, with the implementation of llvm the generator uses for the keys of the
+// pages in the content store. Collisions are still detected by comparing the content before
+// sharing an object.
+static std::string contentHash(const std::string &data) {
+    llvm::SHA1 hasher;
+    hasher.update(data);
+    return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+struct DirectoryJob {
+    uint32_t folder;
+    std::string path;
+    std::string rel;
+    std::string signature; // hash of the page, without the generation date
+    bool skipped = false;
+};
+
+FolderTree tree;
+
+void collectDirectories(uint32_t folder, const std::string &path, const std::string &rel,
+                        std::vector<DirectoryJob> &jobs) {
+    jobs.push_back(DirectoryJob{folder, path, rel, {}});
+    for (uint32_t c = tree.nodes[folder].firstChild; c != FolderTree::None; c = tree.nodes[c].nextSibling) {
+        if (tree.nodes[c].isFolder)
+            collectDirectories(c, path + tree.name(c) + "/", rel + "../", jobs);
     }
-    std::cerr << "Generating " << filename << std::endl;
+}
+
+// Folders with more entries only have the first ones in their page
+const size_t maxInlineEntries = 1000;
+
+std::string jsonEscape(const std::string &str) {
+    std::string result;
+    result.reserve(str.size());
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
 
+// Date put in the footer, formatted once since std::localtime is not thread safe
+char generationDate[80];
+std::mutex logMutex;
+
+// directory path -> signature of its index.html from the previous run
+std::map<std::string, std::string> previousState;
+
+void generateDirectory(DirectoryJob &job, const std::string &root) {
+    const std::string &path = job.path;
+    const std::string &rel = job.rel;
+    std::string filename = root + "/" + path + "index.html";
+
+    std::ostringstream myfile;
     std::string data_path = data_url[0] == '.' ? (rel + data_url) : std::string(data_url);
 
 
@@ -144,48 +369,306 @@ void gererateRecursisively(FolderInfo *folder, const std::string &root, const st
         myfile << " <tr><td class='parent'>    <a href='../'>../</a></td><td></td></tr>\n";
     }
 
-    for (auto it : folder->subfolders) {
-        const std::string &name = it.first;
-        if (it.second) {
-            gererateRecursisively(it.second.get(), root, path+name+"/", rel + "../");
-            myfile << "<tr><td class='folder'><a href='"<< name <<"/' class='opener' data-path='" << path << name << "'>[+]</a> "
-                      "<a href='" << name << "/'>" << name << "/</a></td><td></td></tr>\n";
+    // The full listing is in index.json, the page only contains the first entries so it stays
+    // small even for huge folders. indexscript.js loads the rest when asked.
+    std::ostringstream listing;
+    listing << "[";
+    size_t count = 0;
+    for (uint32_t c = tree.nodes[job.folder].firstChild; c != FolderTree::None; c = tree.nodes[c].nextSibling) {
+        std::string name = tree.name(c);
+        if (count)
+            listing << ",";
+        listing << "\n{\"name\":\"" << jsonEscape(name) << "\"";
+        if (tree.nodes[c].isFolder) {
+            listing << ",\"folder\":true}";
+            if (count < maxInlineEntries) {
+                myfile << "<tr><td class='folder'><a href='"<< name <<"/' class='opener' data-path='" << path << name << "'>[+]</a> "
+                          "<a href='" << name << "/'>" << name << "/</a></td><td></td></tr>\n";
+            }
         } else {
-            std::string interestingDefintions = extractMetaFromHTML("woboq:interestingDefinitions", root + "/" + path + name + ".html");
-            myfile << "<tr><td class='file'>    <a href='" << name << ".html'>"
-                   << name
-                   << "</a>"
-                   << "<span class='meta'>";
-            linkInterestingDefinitions(myfile, name+".html", interestingDefintions);
-            myfile << "</span>"
-                   << "</td>"
-                   << "</tr>\n";
+            std::string interestingDefintions;
+            if (hasInterestingDefinitionsIndex) {
+                auto def = interestingDefinitionsIndex.find(path + name);
+                if (def != interestingDefinitionsIndex.end())
+                    interestingDefintions = def->second;
+            } else {
+                interestingDefintions = extractMetaFromHTML("woboq:interestingDefinitions", root + "/" + path + name + ".html");
+            }
+            if (!interestingDefintions.empty())
+                listing << ",\"defs\":\"" << jsonEscape(interestingDefintions) << "\"";
+            listing << "}";
+            if (count < maxInlineEntries) {
+                myfile << "<tr><td class='file'>    <a href='" << name << ".html'>"
+                       << name
+                       << "</a>"
+                       << "<span class='meta'>";
+                linkInterestingDefinitions(myfile, name+".html", interestingDefintions);
+                myfile << "</span>"
+                       << "</td>"
+                       << "</tr>\n";
+            }
         }
+        count++;
+    }
+    listing << "\n]\n";
+    if (count > maxInlineEntries) {
+        myfile << "<tr><td class='more'><a href='index.json' class='more' data-offset='" << maxInlineEntries << "'>"
+               << (count - maxInlineEntries) << " more entries</a></td><td></td></tr>\n";
     }
-
-    char timebuf[80];
-    auto now = std::time(0);
-    auto tm = std::localtime(&now);
-    std::strftime(timebuf, sizeof(timebuf), "%Y-%b-%d", tm);
 
     myfile << "</table>"
-            "<hr/><p id='footer'>\n"
-            "Generated on <em>" << timebuf << "</em>";
-
+            "<hr/><p id='footer'>\n";
+    // Everything but the generation date is part of the signature
+    std::ostringstream footer;
     auto it = project_map.lower_bound(path);
     if (it != project_map.end() && std::equal(it->first.begin(), it->first.end(), path.c_str())) {
-        myfile << " from project " << it->first;
+        footer << " from project " << it->first;
         if (!it->second.empty()) {
-            myfile <<" revision <em>" << it->second << "</em>";
+            footer <<" revision <em>" << it->second << "</em>";
         }
     }
-    myfile << "<br />Powered by <a href='https://woboq.com'><img alt='Woboq' src='https://code.woboq.org/woboq-16.png' width='41' height='16' /></a> <a href='https://code.woboq.org'>Code Browser</a> "
+    footer << "<br />Powered by <a href='https://woboq.com'><img alt='Woboq' src='https://code.woboq.org/woboq-16.png' width='41' height='16' /></a> <a href='https://code.woboq.org'>Code Browser</a> "
             CODEBROWSER_VERSION "\n<br/>Generator usage only permitted with license</p>\n</body></html>\n";
+
+    std::string head = myfile.str();
+    std::string tail = footer.str();
+    std::string json = listing.str();
+    job.signature = contentHash(head + tail + json);
+    std::string jsonFilename = root + "/" + path + "index.json";
+
+    auto previous = previousState.find(path);
+    if (previous != previousState.end() && previous->second == job.signature) {
+        std::ifstream existing(filename);
+        std::ifstream existingJson(jsonFilename);
+        if (existing && existingJson) {
+            job.skipped = true;
+            return;
+        }
+    }
+
+    std::ofstream outfile(filename);
+    if (!outfile) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cerr << "Error generating " << filename << std::endl;
+        job.signature.clear();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cerr << "Generating " << filename << std::endl;
+    }
+    outfile << head << "Generated on <em>" << generationDate << "</em>" << tail;
+    std::ofstream jsonfile(jsonFilename);
+    jsonfile << json;
+    if (!outfile || !jsonfile) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cerr << "Error writing " << jsonFilename << std::endl;
+        job.signature.clear();
+    }
+}
+
+// ATTENTION: Keep in sync with normalizeForfnIndex in annotator.cpp and getFileSearchKey in the javascript
+static char normalizeForSearch(char c) {
+    if (c >= 'A' && c <= 'Z')
+        c = c - 'A' + 'a';
+    if (c < 'a' || c > 'z')
+        return '_';
+    return c;
 }
 
+/* Write back the fileIndex sorted and without the duplicates appended by the generators,
+ * and split it in the fileSearch directory, so the search does not have to download all
+ * of it: the file fileSearch/xyz lists all the paths that have a component containing the
+ * characters xyz (normalized like for the function search). Any part of three characters of a
+ * component of the search term finds all the paths it can match in a single shard.
+ * The missing shards are empty. */
+void writeFileSearch(const std::string &root) {
+    std::string sorted;
+    sorted.reserve(tree.data.size());
+    std::vector<std::pair<uint32_t, uint32_t>> entries; // trigram, line
+    for (uint32_t l = 0; l < tree.lines.size(); ++l) {
+        size_t begin = tree.lines[l].first;
+        size_t end = begin + tree.lines[l].second;
+        sorted.append(tree.data, begin, end - begin);
+        sorted += '\n';
+        size_t firstEntry = entries.size();
+        for (size_t pos = begin; pos + 2 < end; ++pos) {
+            if (tree.data[pos] == '/' || tree.data[pos + 1] == '/' || tree.data[pos + 2] == '/')
+                continue;
+            uint32_t key = (uint32_t(uint8_t(normalizeForSearch(tree.data[pos]))) << 16)
+                         | (uint32_t(uint8_t(normalizeForSearch(tree.data[pos + 1]))) << 8)
+                         | uint8_t(normalizeForSearch(tree.data[pos + 2]));
+            entries.emplace_back(key, l);
+        }
+        // Each path only once per shard
+        std::sort(entries.begin() + firstEntry, entries.end());
+        entries.erase(std::unique(entries.begin() + firstEntry, entries.end()), entries.end());
+    }
+    if (sorted != tree.data)
+        writeIfChanged(root + "/fileIndex", sorted);
+
+    std::stable_sort(entries.begin(), entries.end(), [](const std::pair<uint32_t, uint32_t> &a,
+                                                        const std::pair<uint32_t, uint32_t> &b) {
+        return a.first < b.first;
+    });
+    std::string dir = root + "/fileSearch";
+    create_directories(dir);
+    const char alphabet[] = "_abcdefghijklmnopqrstuvwxyz";
+    auto entry = entries.begin();
+    for (char c1 : alphabet) {
+        if (!c1) break;
+        for (char c2 : alphabet) {
+            if (!c2) break;
+            for (char c3 : alphabet) {
+                if (!c3) break;
+                uint32_t key = (uint32_t(uint8_t(c1)) << 16) | (uint32_t(uint8_t(c2)) << 8) | uint8_t(c3);
+                while (entry != entries.end() && entry->first < key)
+                    ++entry;
+                std::string shard = dir + "/" + c1 + c2 + c3;
+                std::string content;
+                for (; entry != entries.end() && entry->first == key; ++entry) {
+                    content.append(tree.data, tree.lines[entry->second].first, tree.lines[entry->second].second);
+                    content += '\n';
+                }
+                if (content.empty()) {
+                    std::remove(shard.c_str());
+                    continue;
+                }
+                if (!writeIfChanged(shard, content))
+                    std::cerr << "Error generating " << shard << std::endl;
+            }
+        }
+    }
+    // The shards of two characters written by the older versions
+    for (char c1 : alphabet) {
+        if (!c1) break;
+        for (char c2 : alphabet) {
+            if (!c2) break;
+            std::remove((dir + "/" + c1 + c2).c_str());
+        }
+    }
+}
+
+void loadState(const std::string &stateFile) {
+    std::ifstream filein(stateFile);
+    for (std::string line; std::getline(filein, line); ) {
+        auto sep = line.rfind('|');
+        if (sep != std::string::npos)
+            previousState[line.substr(0, sep)] = line.substr(sep + 1);
+    }
+}
+
+void saveState(const std::string &stateFile, const std::vector<DirectoryJob> &jobs) {
+    std::string tmp = stateFile + ".tmp";
+    {
+        std::ofstream fileout(tmp);
+        for (const auto &job : jobs) {
+            if (!job.signature.empty())
+                fileout << job.path << '|' << job.signature << '\n';
+        }
+        if (!fileout) {
+            std::cerr << "Error writing " << tmp << std::endl;
+            return;
+        }
+    }
+    std::rename(tmp.c_str(), stateFile.c_str());
+}
+
+void generateDirectories(const std::string &root, unsigned int jobCount) {
+    std::string stateFile = root + "/indexState";
+    loadState(stateFile);
+
+    std::vector<DirectoryJob> jobs;
+    collectDirectories(0, "", "", jobs);
+
+    auto now = std::time(0);
+    auto tm = std::localtime(&now);
+    std::strftime(generationDate, sizeof(generationDate), "%Y-%b-%d", tm);
+
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i = next++; i < jobs.size(); i = next++)
+            generateDirectory(jobs[i], root);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobCount && i < jobs.size(); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads)
+        t.join();
+
+    size_t skipped = std::count_if(jobs.begin(), jobs.end(), [](const DirectoryJob &job) { return job.skipped; });
+    if (skipped)
+        std::cerr << skipped << " of " << jobs.size() << " directories unchanged" << std::endl;
+    saveState(stateFile, jobs);
+}
+
+#ifndef _WIN32
+static bool readFile(const std::string &fn, std::string &content) {
+    std::ifstream in(fn, std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    content = ss.str();
+    return true;
+}
+
+/**
+ * Move all the files from the directory (recursively) into the content store and replace them by
+ * relative symlinks. The files that are the same across revisions are then only stored once.
+ * Both path must be absolute.
+ */
+static void storeDirectory(const std::string &dir, const std::string &store) {
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    std::vector<std::string> entries;
+    while (dirent *e = readdir(d)) {
+        if (e->d_name[0] != '.')
+            entries.push_back(e->d_name);
+    }
+    closedir(d);
+
+    for (const auto &name : entries) {
+        std::string fn = dir + "/" + name;
+        struct stat st;
+        if (lstat(fn.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode)) {
+            storeDirectory(fn, store);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode))
+            continue; // already a link
+        std::string content;
+        if (!readFile(fn, content))
+            continue;
+        std::string hash = contentHash(content);
+        std::string objectDir = store + "/" + hash.substr(0, 2);
+        std::string object = objectDir + "/" + hash.substr(2);
+        std::string existing;
+        if (readFile(object, existing)) {
+            if (existing != content)
+                continue; // hash collision, keep our own copy
+        } else {
+            create_directories(objectDir);
+            if (auto error_code = write_file_atomically(object, content)) {
+                std::cerr << "Error writing " << object << ": " << error_code.message() << std::endl;
+                continue;
+            }
+        }
+        if (auto error_code = create_relative_link(object, fn))
+            std::cerr << "Error linking " << fn << ": " << error_code.message() << std::endl;
+    }
+}
+#endif
+
 int main(int argc, char **argv) {
 
     std::string root;
+    std::string contentStore;
+    unsigned int jobCount = std::max(1u, std::thread::hardware_concurrency());
     bool skipOptions = false;
 
     for (int i = 1; i < argc; ++i) {
@@ -211,6 +694,14 @@ int main(int argc, char **argv) {
                         project_map[s.substr(0, colonPos)] = s.substr(secondColonPos + 1);
                     }
                 }
+            } else if (arg=="-s") {
+                i++;
+                if (i < argc)
+                    contentStore = argv[i];
+            } else if (arg=="-j") {
+                i++;
+                if (i < argc)
+                    jobCount = std::max(1, std::atoi(argv[i]));
             } else if (arg=="-e") {
                 i++;
                 // ignore -e XXX  for compatibility with the generator project definitions
@@ -226,27 +717,34 @@ int main(int argc, char **argv) {
     }
 
     if (root.empty()) {
-        std::cerr << "Usage: " << argv[0] << " <path> [-d data_url] [-p project_definition]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <path> [-d data_url] [-p project_definition] [-s content_store] [-j jobs]" << std::endl;
         return -1;
     }
-    std::ifstream fileIndex(root + "/" + "fileIndex");
-    std::string line;
+    std::ifstream fileIndex(root + "/" + "fileIndex", std::ios::binary);
+    std::ostringstream fileIndexContent;
+    fileIndexContent << fileIndex.rdbuf();
+    tree.build(fileIndexContent.str());
 
-    FolderInfo rootInfo;
-    while (std::getline(fileIndex, line))
-    {
-        FolderInfo *parent = &rootInfo;
+    writeFileSearch(root);
+    loadInterestingDefinitions(root);
+    generateDirectories(root, jobCount);
 
-        unsigned int pos = 0;
-        unsigned int next_pos;
-        while ((next_pos = line.find('/', pos)) < line.size()) {
-            auto &sub = parent->subfolders[line.substr(pos, next_pos - pos)];
-            if (!sub) sub = std::make_shared<FolderInfo>();
-            parent = sub.get();
-            pos = next_pos + 1;
+    if (!contentStore.empty()) {
+#ifndef _WIN32
+        // The refs and function index are complete only once all the generators are done,
+        // so this is the place to move them in the store.
+        char absRoot[PATH_MAX];
+        char absStore[PATH_MAX];
+        create_directories(contentStore);
+        if (!realpath(root.c_str(), absRoot) || !realpath(contentStore.c_str(), absStore)) {
+            std::cerr << "Invalid content store " << contentStore << std::endl;
+            return -1;
         }
-        parent->subfolders[line.substr(pos)]; //make sure it exists;
+        storeDirectory(std::string(absRoot) + "/refs", std::string(absStore) + "/refs");
+        storeDirectory(std::string(absRoot) + "/fnSearch", std::string(absStore) + "/fnSearch");
+#else
+        std::cerr << "The content store is not supported on Windows" << std::endl;
+#endif
     }
-    gererateRecursisively(&rootInfo, root, "");
     return 0;
 }
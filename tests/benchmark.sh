@@ -0,0 +1,87 @@
+#! /bin/bash
+
+#
+# Times the generator on large generated sources, to compare two builds of it:
+#  - stmt.cpp: long function bodies of nested statements, for the parent stack of the
+#    BrowserASTVisitor which is saved and restored around each statement.
+#  - qt.cpp: tests/testqt.cc followed by many functions connecting the signals and slots of
+#    its classes, for the lookup of the methods by QtSupport. Only when pkg-config finds the
+#    Qt 5 headers.
+#
+# Each generator runs RUNS times (default 3) on each source in a new output directory. The best
+# wall time is printed, with the statistics (--print-stats) of its last run. SIZE (default 200)
+# is the number of generated functions.
+#
+# Usage: tests/benchmark.sh /path/to/codebrowser_generator [/path/to/other/codebrowser_generator]
+#
+
+set -e
+
+if [ ! -x "$1" ] || { [ -n "$2" ] && [ ! -x "$2" ]; }; then
+    echo "Usage: $0 /path/to/codebrowser_generator [/path/to/other/codebrowser_generator]" >&2
+    exit 2
+fi
+TESTS=$(cd "$(dirname "$0")" && pwd)
+SIZE=${SIZE:-200}
+RUNS=${RUNS:-3}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+mkdir "$WORK/src"
+
+awk -v size="$SIZE" 'BEGIN {
+    print "struct S { int a; int f(int); };"
+    print "int g(int);"
+    for (i = 0; i < size; ++i) {
+        printf "int function%d(S &s, int n) {\n    int r = 0;\n", i
+        for (j = 0; j < 50; ++j) {
+            print "    for (int k = 0; k < n; ++k) {"
+            print "        if (k % 2) { r += s.f(k) + g(r); } else { while (r > k) { r -= s.a; } }"
+            print "        switch (k) { case 1: r = g(s.a + k); break; default: { r ^= (k << 1) | s.f(r); } }"
+            print "    }"
+        }
+        print "    return r;\n}"
+    }
+}' > "$WORK/src/stmt.cpp"
+SOURCES="stmt.cpp"
+COMMANDS="{ \"directory\": \"$WORK/src\", \"command\": \"c++ -c stmt.cpp\", \"file\": \"stmt.cpp\" }"
+
+if QTFLAGS=$(pkg-config --cflags Qt5Gui Qt5Test 2> /dev/null); then
+    {
+        cat "$TESTS/testqt.cc"
+        awk -v size="$SIZE" 'BEGIN {
+            for (i = 0; i < size; ++i) {
+                printf "void connections%d(MyObject *o, OverrideTest *t, TestNS::C *c) {\n", i
+                print "    QObject::connect(o, SIGNAL(mySignal1(QString,uint,QMap<int,QString>)), o, SLOT(anotherSlot(QString,uint,QMap<int,QString>)));"
+                print "    QObject::connect(o, SIGNAL(mySignal2(QString,uint)), o, SLOT(superSlot1(QString,uint)));"
+                print "    QObject::connect(o, SIGNAL(pointerSignal(const QObject*)), o, SLOT(superSlot2()));"
+                print "    QObject::connect(t, SIGNAL(ovr(QString,int)), t, SLOT(doThings(int)));"
+                print "    QObject::connect(c, SIGNAL(sig2(TestNS::C*)), c, SLOT(MySlot()));"
+                print "    QMetaObject::invokeMethod(o, \"superSlot1\", Q_ARG(QString, \"123\"), Q_ARG(uint, 5));"
+                print "    QMetaObject::invokeMethod(t, \"doThings\");"
+                print "}"
+            }
+        }'
+    } > "$WORK/src/qt.cpp"
+    SOURCES="$SOURCES qt.cpp"
+    COMMANDS="$COMMANDS, { \"directory\": \"$WORK/src\", \"command\": \"c++ -fPIC $QTFLAGS -c qt.cpp\", \"file\": \"qt.cpp\" }"
+else
+    echo "Qt 5 not found with pkg-config, skipping qt.cpp" >&2
+fi
+echo "[ $COMMANDS ]" > "$WORK/src/compile_commands.json"
+
+TIMEFORMAT=%R
+for GENERATOR in "$@"; do
+    for SOURCE in $SOURCES; do
+        best=
+        for run in $(seq "$RUNS"); do
+            rm -rf "$WORK/out"
+            t=$( { time "$GENERATOR" -b "$WORK/src" -o "$WORK/out" -p "bench:$WORK/src" "$WORK/src/$SOURCE" \
+                        --print-stats > /dev/null 2> "$WORK/stats"; } 2>&1 )
+            if [ -z "$best" ] || awk -v t="$t" -v best="$best" 'BEGIN { exit !(t < best) }'; then
+                best=$t
+            fi
+        done
+        echo "$GENERATOR $SOURCE: ${best}s"
+        sed 's/^/    /' "$WORK/stats"
+    done
+done
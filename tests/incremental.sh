@@ -0,0 +1,75 @@
+#! /bin/sh
+
+#
+# Checks the incremental generation with ninja (see --depfile and --outputs-list in the README):
+# after a header changed, running ninja again must regenerate the page of the header, with the
+# uses of its declarations at their new lines and not duplicated.
+#
+# Usage: tests/incremental.sh /path/to/codebrowser_generator
+#
+
+set -e
+
+if [ ! -x "$1" ]; then
+    echo "Usage: $0 /path/to/codebrowser_generator" >&2
+    exit 2
+fi
+GENERATOR=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+mkdir src out
+
+cat > src/shared.h <<EOF
+#pragma once
+int sharedFunction(int);
+EOF
+cat > src/a.cpp <<EOF
+#include "shared.h"
+int a() { return sharedFunction(1); }
+EOF
+cat > src/b.cpp <<EOF
+#include "shared.h"
+int b() { return sharedFunction(2); }
+EOF
+cat > src/compile_commands.json <<EOF
+[
+  { "directory": "$WORK/src", "command": "c++ -c a.cpp", "file": "a.cpp" },
+  { "directory": "$WORK/src", "command": "c++ -c b.cpp", "file": "b.cpp" }
+]
+EOF
+cat > build.ninja <<EOF
+rule codebrowser
+  command = $GENERATOR -b $WORK/src -o $WORK/out -p test:$WORK/src \$in --depfile \$out.d --outputs-list \$out && touch \$out
+  depfile = \$out.d
+  deps = gcc
+build a.outputs: codebrowser src/a.cpp
+build b.outputs: codebrowser src/b.cpp
+EOF
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+check_uses() {
+    refs=out/refs/_Z14sharedFunctioni
+    [ -f "$refs" ] || fail "no refs for sharedFunction"
+    uses=$(grep -c "<use " "$refs" || true)
+    [ "$uses" = 2 ] || fail "$uses uses of sharedFunction instead of 2"
+    decls=$(grep -c "<dec f='test/shared.h' l='$1'" "$refs" || true)
+    [ "$decls" = 1 ] || fail "$decls declarations of sharedFunction at line $1 instead of 1"
+}
+
+ninja -j1 > /dev/null
+[ -f out/test/shared.h.html ] || fail "shared.h was not generated"
+check_uses 2
+
+# The declaration moves one line down
+sed -i.orig '1a\
+// changed' src/shared.h
+ninja -j1 > /dev/null
+grep -q "changed" out/test/shared.h.html || fail "shared.h was not generated again"
+check_uses 3
+
+echo "PASS"